@@ -72,6 +72,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx.clear();
@@ -19,6 +19,11 @@ struct APParam : BaseParam {
     unordered_set<int> indexers;
     int max_update;
     NRVec<int> last_update;
+    APParam* owner;  // whose averages and update counts are shared by this one, NULL by default
+
+    APParam() {
+        owner = NULL;
+    }
 
     // allow sparse and dense parameters have different parameter initialization methods
     inline void initial(int outDim, int inDim, AlignedMemoryPool* mem = NULL) {
@@ -54,6 +59,8 @@ struct APParam : BaseParam {
 
     inline void updateAdagrad(dtype alpha, dtype reg, dtype eps) {
         unordered_set<int>::iterator it;
+        int& max_update = owner ? owner->max_update : this->max_update;
+        NRVec<int>& last_update = owner ? owner->last_update : this->last_update;
         max_update++;
         for (it = indexers.begin(); it != indexers.end(); ++it) {
             int index = *it;
@@ -67,6 +74,8 @@ struct APParam : BaseParam {
 
     inline void updateAdam(dtype belta1, dtype belta2, dtype alpha, dtype reg, dtype eps) {
         unordered_set<int>::iterator it;
+        int& max_update = owner ? owner->max_update : this->max_update;
+        NRVec<int>& last_update = owner ? owner->last_update : this->last_update;
         max_update++;
         for (it = indexers.begin(); it != indexers.end(); ++it) {
             int index = *it;
@@ -122,7 +131,30 @@ struct APParam : BaseParam {
         }
     }
 
+    // the averages are accumulated by all the replicas into those of master, without locks as in SparseParam
+    inline void shareState(BaseParam* master) {
+        APParam* ptr = (APParam*)master;
+        val.share(ptr->val);
+        aux.share(ptr->aux);
+        owner = ptr->owner ? ptr->owner : ptr;
+    }
+
+    //only the rows touched by the replica are merged
+    inline void addGrad(BaseParam* replica) {
+        APParam* ptr = (APParam*)replica;
+        unordered_set<int>::iterator it;
+        for (it = ptr->indexers.begin(); it != ptr->indexers.end(); ++it) {
+            int index = *it;
+            indexers.insert(index);
+            for (int idx = 0; idx < val.row; idx++) {
+                grad[index][idx] += ptr->grad[index][idx];
+            }
+        }
+    }
+
     inline void sumWeight(int featId) {
+        int& max_update = owner ? owner->max_update : this->max_update;
+        NRVec<int>& last_update = owner ? owner->last_update : this->last_update;
         if (last_update[featId] < max_update) {
             int times = max_update - last_update[featId];
             for (int idx = 0; idx < val.row; idx++) {
@@ -199,6 +231,12 @@ struct APParam : BaseParam {
         }
     }
 
+    inline ParamBytes bytes() const {
+        ParamBytes res = BaseParam::bytes();
+        res.optimizer = aux.bytes() + last_update.size() * sizeof(int);
+        return res;
+    }
+
     inline void save(std::ofstream &os)const {
         val.save(os);
         aux.save(os);
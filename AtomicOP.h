@@ -23,13 +23,17 @@ public:
 		in2 = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 	void forward(Graph *cg, PNode x1, PNode x2) {
 		in1 = x1;
 		in2 = x2;
-		val.vec() = x1->val.vec() * x2->val.vec();
 		in1->increase_loc();
 		in2->increase_loc();
+		val.vec() = x1->val.vec() * x2->val.vec();
 		cg->addNode(this);
 	}
 
@@ -64,10 +68,10 @@ public:
 public:
 	void forward(Graph *cg, PNode x) {
 		in = x;
+		in->increase_loc();
 		for (int idx = 0; idx < dim && idx < in->dim; idx++) {
 			val[idx] = in->val[idx];
 		}
-		in->increase_loc();
 		cg->addNode(this);
 	}
 
@@ -103,10 +107,10 @@ public:
 		if (x->dim != 2 * dim) {
 			std::cout << "error during half merging" << std::endl;
 		}
+		in->increase_loc();
 		for (int idx = 0; idx < dim; idx++) {
 			val[idx] = in->val[2 * idx] + in->val[2 * idx + 1];
 		}
-		in->increase_loc();
 		cg->addNode(this);
 	}
 
@@ -149,13 +153,13 @@ public:
 			std::cout << "error: position overflow!" << std::endl;
 			return;
 		}
+		in->increase_loc();
 		int end_pos = start_pos + dim;
 		int offset = 0;
 		for (int idx = start_pos; idx < end_pos; idx++) {
 			val[offset] = in->val[idx];
 			offset++;
 		}
-		in->increase_loc();
 		cg->addNode(this);
 	}
 
@@ -191,13 +195,17 @@ public:
 		in2 = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 	void forward(Graph *cg, PNode x1, PNode x2) {
 		in1 = x1;
 		in2 = x2;
-		val.vec() = x1->val.vec() - x2->val.vec();
 		in1->increase_loc();
 		in2->increase_loc();
+		val.vec() = x1->val.vec() - x2->val.vec();
 		cg->addNode(this);
 	}
 
@@ -332,10 +340,10 @@ public:
 protected:
 	void forward() {
 		for (int idx = 0; idx < nSize; idx++){
-			val.vec() = val.vec() + ins[idx]->val.vec();		
+			ins[idx]->increase_loc();
 		}
 		for (int idx = 0; idx < nSize; idx++){
-			ins[idx]->increase_loc();
+			val.vec() = val.vec() + ins[idx]->val.vec();		
 		}
 	}
 
@@ -357,6 +365,10 @@ public:
 		Node::clearValue();
 		in = NULL;
 	}
+
+	inline bool overwrites() const {
+		return true;
+	}
 	// define the activate function and its derivation form
 	inline void setFunctions(dtype(*f)(const dtype&), dtype(*f_deri)(const dtype&, const dtype&)) {
 		activate = f;
@@ -367,13 +379,13 @@ public:
 
 	inline void forward(Graph *cg, PNode x){
 		in = x;
-		val.vec() = in->val.vec().unaryExpr(ptr_fun(activate));
 		in->increase_loc();
+		activate_forward(activate, in->val, val);
 		cg->addNode(this);
 	}
 
 	inline void backward(){
-		in->loss.vec() += loss.vec() * in->val.vec().binaryExpr(val.vec(), ptr_fun(derivate));
+		activate_backward(derivate, in->val, val, loss, in->loss, true);
 	}
 
 	inline void unlock(){
@@ -399,17 +411,21 @@ public:
 		in = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 
 	inline void forward(Graph *cg, PNode x){
 		in = x;
-		val.vec() = in->val.vec().unaryExpr(ptr_fun(ftanh));
 		in->increase_loc();
+		activate_forward(ftanh, in->val, val);
 		cg->addNode(this);
 	}
 
 	inline void backward(){
-		in->loss.vec() += loss.vec() * in->val.vec().binaryExpr(val.vec(), ptr_fun(dtanh));
+		activate_backward(dtanh, in->val, val, loss, in->loss, true);
 	}
 
 	inline void unlock(){
@@ -435,17 +451,21 @@ public:
 		in = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 
 	inline void forward(Graph *cg, PNode x){
 		in = x;
-		val.vec() = in->val.vec().unaryExpr(ptr_fun(fsigmoid));
 		in->increase_loc();
+		activate_forward(fsigmoid, in->val, val);
 		cg->addNode(this);
 	}
 
 	inline void backward(){
-		in->loss.vec() += loss.vec() * in->val.vec().binaryExpr(val.vec(), ptr_fun(dsigmoid));
+		activate_backward(dsigmoid, in->val, val, loss, in->loss, true);
 	}
 
 	inline void unlock(){
@@ -470,16 +490,20 @@ public:
 		in = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 	inline void forward(Graph *cg, PNode x){
 		in = x;
-		val.vec() = in->val.vec().unaryExpr(ptr_fun(frelu));
 		in->increase_loc();
+		activate_forward(frelu, in->val, val);
 		cg->addNode(this);
 	}
 
 	inline void backward(){
-		in->loss.vec() += loss.vec() * in->val.vec().binaryExpr(val.vec(), ptr_fun(drelu));
+		activate_backward(drelu, in->val, val, loss, in->loss, true);
 	}
 
 	inline void unlock(){
@@ -505,6 +529,10 @@ public:
 		in2 = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 	void forward(Graph *cg, PNode x1, PNode x2) {
 		in1 = x1;
@@ -513,12 +541,12 @@ public:
 		if(dim != 1 || in1->dim != in2->dim){
 			std::cout << "warning: input dims of PDotNode do not match" << std::endl;
 		}
+		in1->increase_loc();
+		in2->increase_loc();
 		val[0] = 0.0;
 		for (int idx = 0; idx < in1->dim; idx++) {
 			val[0] += x1->val[idx] * x2->val[idx];
 		}
-		in1->increase_loc();
-		in2->increase_loc();
 		cg->addNode(this);
 	}
 
@@ -58,6 +58,8 @@ public:
 
 	SoftmaxBuilder _softmax_layer;
 	vector<PMultNode> _muls;
+
+	vector<PNode> _inputs, _update_nodes, _mul_nodes;
 	PAddNode _output;
 
 	AttRecursiveGatedBuilder(){
@@ -104,12 +106,19 @@ public:
 		_output.init(_outDim, dropout, mem);
 	}
 
+	inline size_t bytes() const {
+		return _reset_left.bytes() + _reset_right.bytes() + _update_left.bytes()
+			+ _update_right.bytes() + _recursive_tilde.bytes() + _update_tilde.bytes()
+			+ _mul_left.bytes() + _mul_right.bytes() + _softmax_layer.bytes() + nodeBytes(_muls)
+			+ _output.bytes();
+	}
+
 	inline void forward(Graph *cg, PNode left, PNode right, PNode target){
-		vector<PNode> x;
-		x.push_back(left);
-		x.push_back(right);
-		x.push_back(target);
-		forward(cg, x);
+		_inputs.resize(3);
+		_inputs[0] = left;
+		_inputs[1] = right;
+		_inputs[2] = target;
+		forward(cg, _inputs);
 	}
 
 	// 0 left, 1 right, 2target
@@ -128,16 +137,17 @@ public:
 		_update_right.forward(cg, x[1], x[2]);
 		_update_tilde.forward(cg, &_recursive_tilde, x[2]);
 
-		vector<PNode> _update_nodes;
-		_update_nodes.push_back(&_update_left);
-		_update_nodes.push_back(&_update_right);
-		_update_nodes.push_back(&_update_tilde);
+		_update_nodes.resize(3);
+		_update_nodes[0] = &_update_left;
+		_update_nodes[1] = &_update_right;
+		_update_nodes[2] = &_update_tilde;
 
 		_softmax_layer.forward(cg, _update_nodes);
 		_muls[0].forward(cg, x[0], &_softmax_layer._output[0]);
 		_muls[1].forward(cg, x[1], &_softmax_layer._output[1]);
 		_muls[2].forward(cg, &_update_tilde, &_softmax_layer._output[2]);
-		_output.forward(cg, getPNodes(_muls, 3));
+		getPNodes(_muls, 3, _mul_nodes);
+		_output.forward(cg, _mul_nodes);
 	}
 };
 
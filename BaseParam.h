@@ -10,23 +10,59 @@
 
 #include "MyTensor.h"
 
-struct BaseParam {
-	Tensor2D val;
-	Tensor2D grad;
+// bytes of a param, shared memory not counted
+struct ParamBytes {
+	size_t value;
+	size_t gradient;
+	size_t optimizer;  //e.g., aux_square and aux_mean
+
+	inline size_t total() const {
+		return value + gradient + optimizer;
+	}
+};
+
+// the params are templated on the scalar type of their values, as the nodes reading them, BaseParam holds dtype
+template<typename T>
+struct BaseParamT {
+	Tensor2DT<T> val;
+	Tensor2DT<T> grad;
 public:
 	virtual inline void initial(int outDim, int inDim, AlignedMemoryPool* mem) = 0;
-	virtual inline void updateAdagrad(dtype alpha, dtype reg, dtype eps) = 0;
-	virtual inline void updateAdam(dtype belta1, dtype belta2, dtype alpha, dtype reg, dtype eps) = 0;
+	virtual inline void updateAdagrad(T alpha, T reg, T eps) = 0;
+	virtual inline void updateAdam(T belta1, T belta2, T alpha, T reg, T eps) = 0;
 	virtual inline int outDim() = 0;
 	virtual inline int inDim() = 0;
 	virtual inline void clearGrad() = 0;
 
 	// Choose one point randomly
 	virtual inline void randpoint(int& idx, int &idy) = 0;
-	virtual inline dtype squareGradNorm() = 0;
-	virtual inline void rescaleGrad(dtype scale) = 0;
+	virtual inline T squareGradNorm() = 0;
+	virtual inline void rescaleGrad(T scale) = 0;
+	// add the gradients of a replica with the same dims, used for data-parallel training
+	virtual inline void addGrad(BaseParamT* replica) = 0;
 	virtual inline void save(std::ofstream &os)const = 0;
 	virtual inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) = 0;
+
+	virtual inline ParamBytes bytes() const {
+		ParamBytes res;
+		res.value = val.bytes();
+		res.gradient = grad.bytes();
+		res.optimizer = 0;
+		return res;
+	}
+
+	// the replica reads the values of master, gradients are kept by itself
+	inline void shareValue(BaseParamT* master) {
+		val.share(master->val);
+	}
+
+	// the replica also shares the optimizer states, so that it can update master directly (hogwild)
+	virtual inline void shareState(BaseParamT* master) {
+		std::cout << "warning: optimizer states can not be shared, only values are shared." << std::endl;
+		shareValue(master);
+	}
 };
 
+typedef BaseParamT<dtype> BaseParam;
+
 #endif /* BasePARAM_H_ */
@@ -0,0 +1,248 @@
+#ifndef BICELL_H_
+#define BICELL_H_
+
+#include "MyLib.h"
+#include "Node.h"
+#include "Graph.h"
+#include "SeqProj.h"
+#include "LSTMCell.h"
+#include "GRUCell.h"
+#include "ThreadPool.h"
+
+// the nodes of one direction in the order of computation: the projections, then the steps.
+// they are linked and their dropout seeds drawn on the graph thread, computed on a worker,
+// and then added to the graph in the same order as the forward of their builder would.
+template<typename Cell>
+struct CellChain {
+	vector<SeqProjNode*> projs;
+	vector<Cell*> steps;
+
+	inline void clear() {
+		projs.clear();
+		steps.clear();
+	}
+
+	inline void drawmask(bool train) {
+		for (int idx = 0; idx < steps.size(); idx++) {
+			steps[idx]->drawmask(train);
+		}
+	}
+
+	inline void compute(bool train) {
+		for (int idx = 0; idx < projs.size(); idx++) {
+			projs[idx]->compute();
+		}
+		for (int idx = 0; idx < steps.size(); idx++) {
+			steps[idx]->compute();
+			steps[idx]->applydrop_drawn(train);
+		}
+	}
+
+	inline void attach(Graph *cg) {
+		for (int idx = 0; idx < projs.size(); idx++) {
+			projs[idx]->acquire(cg);
+			cg->addNode(projs[idx], true);
+		}
+		for (int idx = 0; idx < steps.size(); idx++) {
+			steps[idx]->acquire(cg);
+			cg->addNode(steps[idx], true);
+		}
+	}
+};
+
+// computes the two chains on two workers of pool, or one after the other without it
+template<typename Cell>
+inline void run_chains(Graph *cg, ThreadPool* pool, CellChain<Cell>& left, CellChain<Cell>& right) {
+	left.drawmask(cg->train);
+	right.drawmask(cg->train);
+	if (pool != NULL && pool->size() >= 2) {
+		pool->run([&](int worker) {
+			if (worker == 0) left.compute(cg->train);
+			else if (worker == 1) right.compute(cg->train);
+		});
+	}
+	else {
+		left.compute(cg->train);
+		right.compute(cg->train);
+	}
+	left.attach(cg);
+	right.attach(cg);
+}
+
+// the two directions of a bidirectional LSTM1 layer, i.e., LSTMCellBuilder with _left2right true and false,
+// whose chains are independent until their hiddens are concatenated, so they are computed concurrently
+// by the workers of pool (opt-in, NULL by default). the backward of the two chains runs concurrently
+// by the graph's backward_pool, e.g., the same pool: their params, hence gradients, are disjoint,
+// and only the losses of the shared inputs are added to in turn.
+class BiLSTMCellBuilder {
+public:
+	LSTMCellBuilder _left, _right;
+	ThreadPool* _pool;
+
+protected:
+	CellChain<LSTMCellNode> _lchain, _rchain;
+
+public:
+	BiLSTMCellBuilder() {
+		clear();
+	}
+
+	~BiLSTMCellBuilder() {
+		clear();
+	}
+
+public:
+	inline void init(LSTMCellParams* left, LSTMCellParams* right, dtype dropout, ThreadPool* pool = NULL, AlignedMemoryPool* mem = NULL) {
+		_left.init(left, dropout, true, mem);
+		_right.init(right, dropout, false, mem);
+		_pool = pool;
+	}
+
+	inline size_t bytes() const {
+		return _left.bytes() + _right.bytes();
+	}
+
+	inline void resize(int maxsize) {
+		_left.resize(maxsize);
+		_right.resize(maxsize);
+	}
+
+	inline void clear() {
+		_left.clear();
+		_right.clear();
+		_pool = NULL;
+		_lchain.clear();
+		_rchain.clear();
+	}
+
+public:
+	inline void forward(Graph *cg, const vector<PNode>& x) {
+		if (!cg->detachable()) {
+			_left.forward(cg, x);
+			_right.forward(cg, x);
+			return;
+		}
+		if (x.size() == 0) {
+			std::cout << "empty inputs for lstm operation" << std::endl;
+			return;
+		}
+		if (x[0]->val.dim != _left._inDim || x[0]->val.dim != _right._inDim) {
+			std::cout << "input dim does not match for bilstm operation" << std::endl;
+			return;
+		}
+		int nSize = x.size();
+		if (!_left.reserve(nSize) || !_right.reserve(nSize)) return;
+		_left._nSize = _right._nSize = nSize;
+		for (int idx = 0; idx < nSize; idx++) {
+			cg->require(x[idx]);
+		}
+
+		link(_left, _lchain, x);
+		link(_right, _rchain, x);
+		run_chains(cg, _pool, _lchain, _rchain);
+	}
+
+protected:
+	inline void link(LSTMCellBuilder& builder, CellChain<LSTMCellNode>& chain, const vector<PNode>& x) {
+		int nSize = x.size();
+		chain.clear();
+		builder._proj.link(x);
+		chain.projs.push_back(&builder._proj);
+		for (int step = 0; step < nSize; step++) {
+			int idx = builder._left2right ? step : nSize - 1 - step;
+			int last = builder._left2right ? idx - 1 : idx + 1;
+			LSTMCellNode* node = &builder._hiddens[idx];
+			node->link(step == 0 ? NULL : &builder._hiddens[last], &builder._proj, idx);
+			chain.steps.push_back(node);
+		}
+	}
+};
+
+// the bidirectional GRNN layer by GRUCellBuilder, as BiLSTMCellBuilder
+class BiGRUCellBuilder {
+public:
+	GRUCellBuilder _left, _right;
+	ThreadPool* _pool;
+
+protected:
+	CellChain<GRUCellNode> _lchain, _rchain;
+
+public:
+	BiGRUCellBuilder() {
+		clear();
+	}
+
+	~BiGRUCellBuilder() {
+		clear();
+	}
+
+public:
+	inline void init(GRUCellParams* left, GRUCellParams* right, dtype dropout, ThreadPool* pool = NULL, AlignedMemoryPool* mem = NULL) {
+		_left.init(left, dropout, true, mem);
+		_right.init(right, dropout, false, mem);
+		_pool = pool;
+	}
+
+	inline size_t bytes() const {
+		return _left.bytes() + _right.bytes();
+	}
+
+	inline void resize(int maxsize) {
+		_left.resize(maxsize);
+		_right.resize(maxsize);
+	}
+
+	inline void clear() {
+		_left.clear();
+		_right.clear();
+		_pool = NULL;
+		_lchain.clear();
+		_rchain.clear();
+	}
+
+public:
+	inline void forward(Graph *cg, const vector<PNode>& x) {
+		if (!cg->detachable()) {
+			_left.forward(cg, x);
+			_right.forward(cg, x);
+			return;
+		}
+		if (x.size() == 0) {
+			std::cout << "empty inputs for GRU operation" << std::endl;
+			return;
+		}
+		if (x[0]->val.dim != _left._inDim || x[0]->val.dim != _right._inDim) {
+			std::cout << "input dim does not match for BiGRU operation" << std::endl;
+			return;
+		}
+		int nSize = x.size();
+		if (!_left.reserve(nSize) || !_right.reserve(nSize)) return;
+		_left._nSize = _right._nSize = nSize;
+		for (int idx = 0; idx < nSize; idx++) {
+			cg->require(x[idx]);
+		}
+
+		link(_left, _lchain, x);
+		link(_right, _rchain, x);
+		run_chains(cg, _pool, _lchain, _rchain);
+	}
+
+protected:
+	inline void link(GRUCellBuilder& builder, CellChain<GRUCellNode>& chain, const vector<PNode>& x) {
+		int nSize = x.size();
+		chain.clear();
+		builder._proj.link(x);
+		builder._cproj.link(x);
+		chain.projs.push_back(&builder._proj);
+		chain.projs.push_back(&builder._cproj);
+		for (int step = 0; step < nSize; step++) {
+			int idx = builder._left2right ? step : nSize - 1 - step;
+			int last = builder._left2right ? idx - 1 : idx + 1;
+			GRUCellNode* node = &builder._output[idx];
+			node->link(step == 0 ? NULL : &builder._output[last], &builder._proj, &builder._cproj, idx);
+			chain.steps.push_back(node);
+		}
+	}
+};
+
+#endif
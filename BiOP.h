@@ -13,20 +13,21 @@
 #include "Node.h"
 #include "Graph.h"
 
-struct BiParams {
+template<typename T>
+struct BiParamsT {
 public:
-	Param W1;
-	Param W2;
-	Param b;
+	ParamT<T> W1;
+	ParamT<T> W2;
+	ParamT<T> b;
 
 	bool bUseB;
 
 public:
-	BiParams() {
+	BiParamsT() {
 		bUseB = true;
 	}
 
-	inline void exportAdaParams(ModelUpdate& ada) {
+	inline void exportAdaParams(ModelUpdateT<T>& ada) {
 		ada.addParam(&W1);
 		ada.addParam(&W2);
 		if (bUseB) {
@@ -63,24 +64,36 @@ public:
 
 };
 
+typedef BiParamsT<dtype> BiParams;
+
 // non-linear feed-forward node
 // input nodes should be specified by forward function
 // for input variables, we exploit column vector,
 // which means a concrete input vector x_i is represented by x(0, i), x(1, i), ..., x(n, i)
-struct BiNode : Node {
+template<typename T>
+struct BiNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
+	using Node::inference;
+
 public:
 	PNode in1, in2;
-	Tensor1D ty, lty; 
+	Tensor1DT<T> ty, lty; 
 
 	int inDim1, inDim2;
 
-	BiParams* param;
+	BiParamsT<T>* param;
 
-	dtype (*activate)(const dtype&);   // activation function
-	dtype (*derivate)(const dtype&, const dtype&);  // derivation function of activation function
+	T (*activate)(const T&);   // activation function
+	T (*derivate)(const T&, const T&);  // derivation function of activation function
 
 public:
-	BiNode() : Node() {
+	BiNodeT() : Node() {
 		in1 = NULL;
 		in2 = NULL;
 		
@@ -92,12 +105,16 @@ public:
 		inDim2 = 0;		
 	}
 
-	inline void setParam(BiParams* paramInit) {
+	inline void setParam(BiParamsT<T>* paramInit) {
 		param = paramInit;
 		inDim1 = param->W1.inDim();
 		inDim2 = param->W2.inDim();
 	}
 
+	inline double flops() const {
+		return 2.0 * (inDim1 + inDim2) * dim;
+	}
+
 
 	inline void clearValue(){
 		Node::clearValue();
@@ -107,38 +124,52 @@ public:
 		lty.zero();
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 	// define the activation function and its derivation form
-	inline void setFunctions(dtype (*f)(const dtype&), dtype (*f_deri)(const dtype&, const dtype&)) {
+	inline void setFunctions(T (*f)(const T&), T (*f_deri)(const T&, const T&)) {
 		activate = f;
 		derivate = f_deri;
 	}
 	
-	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+	inline void init(int dim, T dropOut, AlignedMemoryPool* mem = NULL){
 		Node::init(dim, dropOut, mem);
 		ty.init(dim, mem);
-		lty.init(dim, mem);		
+		if (!inference) lty.init(dim, mem);		
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes() + lty.bytes();
 	}
 
 public:
 	void forward(Graph* cg, PNode x1, PNode x2) {
 		in1 = x1;
 		in2 = x2;
+		cg->require(in1);
+		cg->require(in2);
+		in1->increase_loc();
+		in2->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
 		ty.mat() = param->W1.val.mat() * in1->val.mat() + param->W2.val.mat() * in2->val.mat();
 
 		if(param->bUseB){
 			ty.vec() += param->b.val.vec();
 		}
 
-		val.vec() = ty.vec().unaryExpr(ptr_fun(activate));
-
-		in1->increase_loc();
-		in2->increase_loc();
-
-		cg->addNode(this);
+		activate_forward(activate, ty, val);
 	}
 
 	void backward() {
-		lty.vec() = loss.vec() * ty.vec().binaryExpr(val.vec(), ptr_fun(derivate));
+		activate_backward(derivate, ty, val, loss, lty, false);
 
 		param->W1.grad.mat() += lty.mat() * in1->val.tmat();
 		param->W2.grad.mat() += lty.mat() * in2->val.tmat();
@@ -152,6 +183,62 @@ public:
 
 	}
 
+public:
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	// one GEMM per weight for all the nodes sharing param
+	inline void forward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x1(inDim1, count), x2(inDim2, count), y(dim, count);
+		for (int idx = 0; idx < count; idx++) {
+			BiNodeT* ptr = (BiNodeT*)batch[idx];
+			x1.col(idx) = ptr->in1->val.mat();
+			x2.col(idx) = ptr->in2->val.mat();
+		}
+
+		y.noalias() = param->W1.val.mat() * x1;
+		y.noalias() += param->W2.val.mat() * x2;
+
+		for (int idx = 0; idx < count; idx++) {
+			BiNodeT* ptr = (BiNodeT*)batch[idx];
+			ptr->ty.mat() = y.col(idx);
+			if (param->bUseB) {
+				ptr->ty.vec() += param->b.val.vec();
+			}
+			activate_forward(ptr->activate, ptr->ty, ptr->val);
+		}
+	}
+
+	inline void backward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x1(inDim1, count), x2(inDim2, count), ly(dim, count);
+		MatBufferT<T> lx1(inDim1, count), lx2(inDim2, count);
+		for (int idx = 0; idx < count; idx++) {
+			BiNodeT* ptr = (BiNodeT*)batch[idx];
+			activate_backward(ptr->derivate, ptr->ty, ptr->val, ptr->loss, ptr->lty, false);
+			ly.col(idx) = ptr->lty.mat();
+			x1.col(idx) = ptr->in1->val.mat();
+			x2.col(idx) = ptr->in2->val.mat();
+		}
+
+		param->W1.grad.mat().noalias() += ly * x1.transpose();
+		param->W2.grad.mat().noalias() += ly * x2.transpose();
+
+		if (param->bUseB) {
+			param->b.grad.mat() += ly.rowwise().sum();
+		}
+
+		lx1.noalias() = param->W1.val.mat().transpose() * ly;
+		lx2.noalias() = param->W2.val.mat().transpose() * ly;
+		for (int idx = 0; idx < count; idx++) {
+			BiNodeT* ptr = (BiNodeT*)batch[idx];
+			ptr->in1->loss.mat() += lx1.col(idx);
+			ptr->in2->loss.mat() += lx2.col(idx);
+		}
+	}
+
 	inline void unlock(){
 		in1->decrease_loc();
 		in2->decrease_loc();
@@ -162,15 +249,26 @@ public:
 
 };
 
+typedef BiNodeT<dtype> BiNode;
+
+
+template<typename T>
+struct LinearBiNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
 
-struct LinearBiNode : Node {
 public:
 	PNode in1, in2;
 	int inDim1, inDim2;
-	BiParams* param;
+	BiParamsT<T>* param;
 
 public:
-	LinearBiNode() : Node() {
+	LinearBiNodeT() : Node() {
 		in1 = NULL;
 		in2 = NULL;
 		
@@ -180,12 +278,20 @@ public:
 		inDim2 = 0;		
 	}
 
-	inline void setParam(BiParams* paramInit) {
+	inline void setParam(BiParamsT<T>* paramInit) {
 		param = paramInit;
 		inDim1 = param->W1.inDim();
 		inDim2 = param->W2.inDim();
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline double flops() const {
+		return 2.0 * (inDim1 + inDim2) * dim;
+	}
+
 
 	inline void clearValue(){
 		Node::clearValue();
@@ -193,20 +299,23 @@ public:
 		in2 = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 
 public:
 	void forward(Graph* cg, PNode x1, PNode x2) {
 		in1 = x1;
 		in2 = x2;
+		in1->increase_loc();
+		in2->increase_loc();
 		val.mat() = param->W1.val.mat() * in1->val.mat() + param->W2.val.mat() * in2->val.mat();
 
 		if(param->bUseB){
 			val.vec() += param->b.val.vec();
 		}
 
-		in1->increase_loc();
-		in2->increase_loc();
-
 		cg->addNode(this);
 	}
 
@@ -233,4 +342,6 @@ public:
 
 };
 
+typedef LinearBiNodeT<dtype> LinearBiNode;
+
 #endif /* BIOP_H_ */
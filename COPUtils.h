@@ -565,6 +565,9 @@ protected:
 	void forward(const int& dim) {
 		int oDim;
 		dtype sum = 0;
+		for (int idx = 0; idx < nSize; idx++){
+			ins[idx]->increase_loc();
+		}
 		for (int idx = 0; idx < nSize; idx++){
 			oDim = ins[idx]->val.dim;
 			if (oDim == 1){
@@ -574,9 +577,6 @@ protected:
 				sum += ins[idx]->val[dim];
 			}
 		}
-		for (int idx = 0; idx < nSize; idx++){
-			ins[idx]->increase_loc();
-		}
 		val[0] += sum;
 		dimId = dim;
 	}
@@ -693,14 +693,14 @@ public:
 
 protected:
 	void forward() {
+		for (int idx = 0; idx < nSize; idx++){
+			ins[idx]->increase_loc();
+		}
 		for (int idx = 0; idx < nSize; idx++){
 			for (int idy = 0; idy < dim; idy++){
 				val[idy] += ins[idx]->val[idy];
 			}
 		}
-		for (int idx = 0; idx < nSize; idx++){
-			ins[idx]->increase_loc();
-		}
 	}
 
 };
@@ -822,14 +822,14 @@ public:
 
 protected:
 	void forward() {
+		for (int idx = 0; idx < nSize; idx++){
+			ins[idx]->increase_loc();
+		}
 		for (int idx = 0; idx < nSize; idx++){
 			for (int idy = 0; idy < dim; idy++){
 				val[idy] += scale * ins[idx]->val[idy];
 			}
 		}
-		for (int idx = 0; idx < nSize; idx++){
-			ins[idx]->increase_loc();
-		}
 	}
 
 };
@@ -5,6 +5,8 @@
 #include "Metric.h"
 #include "Param.h"
 #include "Node.h"
+#include "Profiler.h"
+#include "ScratchArena.h"
 
 using namespace Eigen;
 
@@ -12,7 +14,7 @@ struct CRFMLLoss{
 public:
 	Param T;
 	int labelSize;
-	vector<dtype> buffer;
+	vector<ltype> buffer;
 	dtype eps;
 
 public:
@@ -39,7 +41,11 @@ public:
 	}
 
 public:
-	inline dtype loss(const vector<PNode>& x, const vector<vector<dtype> >&answer, Metric& eval, int batchsize = 1){
+	template<typename S>
+	inline dtype loss(const vector<NodeT<S>*>& x, const vector<vector<dtype> >&answer, Metric& eval, int batchsize = 1){
+		ProfileScope scope("CRFMLLoss::loss", 4.0 * x.size() * labelSize * labelSize);
+		ScratchScope scratch;
+		settle_nodes(x);
 		assert(x.size() > 0 && x.size() == answer.size());
 		int nDim = x[0]->dim;
 		if (labelSize != nDim || labelSize != answer[0].size()) {
@@ -52,8 +58,8 @@ public:
 		}
 
 		// comute alpha values
-		NRMat<dtype> alpha(seq_size, labelSize);
-		NRMat<dtype> alpha_answer(seq_size, labelSize);
+		ScratchMat<ltype> alpha(seq_size, labelSize);
+		ScratchMat<ltype> alpha_answer(seq_size, labelSize);
 		alpha = 0.0; alpha_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -80,17 +86,17 @@ public:
 		for (int j = 0; j < labelSize; ++j) {
 			buffer[j] = alpha[seq_size - 1][j];
 		}
-		dtype logZ = logsumexp(buffer);
+		ltype logZ = logsumexp(buffer);
 
 		for (int j = 0; j < labelSize; ++j) {
 			buffer[j] = alpha_answer[seq_size - 1][j];
 		}
-		dtype logZ_answer = logsumexp(buffer);
-		dtype cost = (logZ - logZ_answer) / batchsize;
+		ltype logZ_answer = logsumexp(buffer);
+		ltype cost = (logZ - logZ_answer) / batchsize;
 
 		// comute belta values
-		NRMat<dtype> belta(seq_size, labelSize);
-		NRMat<dtype> belta_answer(seq_size, labelSize);
+		ScratchMat<ltype> belta(seq_size, labelSize);
+		ScratchMat<ltype> belta_answer(seq_size, labelSize);
 		belta = 0.0; belta_answer = 0.0;
 		for (int idx = seq_size - 1; idx >= 0; idx--) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -112,19 +118,19 @@ public:
 			}
 		}
 
-		NRMat<dtype> margin(seq_size, labelSize);
-		NRMat<dtype> trans(labelSize, labelSize);
-		NRMat<dtype> margin_answer(seq_size, labelSize);
-		NRMat<dtype> trans_answer(labelSize, labelSize);
+		ScratchMat<ltype> margin(seq_size, labelSize);
+		ScratchMat<ltype> trans(labelSize, labelSize);
+		ScratchMat<ltype> margin_answer(seq_size, labelSize);
+		ScratchMat<ltype> trans_answer(labelSize, labelSize);
 		margin = 0.0; trans = 0.0; margin_answer = 0.0; trans_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
-			dtype sum = 0.0, sum_answer = 0.0;
+			ltype sum = 0.0, sum_answer = 0.0;
 			for (int i = 0; i < labelSize; ++i) {
 				margin[idx][i] = exp(alpha[idx][i] + belta[idx][i] - logZ);
 				margin_answer[idx][i] = exp(alpha_answer[idx][i] + belta_answer[idx][i] - logZ_answer);
 				if (idx > 0) {
 					for (int j = 0; j < labelSize; ++j) {
-						dtype logvalue = alpha[idx - 1][j] + x[idx]->val[i] + T.val[j][i] + belta[idx][i] - logZ;
+						ltype logvalue = alpha[idx - 1][j] + x[idx]->val[i] + T.val[j][i] + belta[idx][i] - logZ;
 						trans[j][i] += exp(logvalue);
 						logvalue = alpha_answer[idx - 1][j] + x[idx]->val[i] + T.val[j][i] + belta_answer[idx][i] - logZ_answer;
 						trans_answer[j][i] += exp(logvalue);
@@ -174,7 +180,11 @@ public:
 	}
 
 	//viterbi decode algorithm
-	inline void predict(const vector<PNode>& x, vector<int>& y){
+	template<typename S>
+	inline void predict(const vector<NodeT<S>*>& x, vector<int>& y){
+		ProfileScope scope("CRFMLLoss::predict", 4.0 * x.size() * labelSize * labelSize);
+		ScratchScope scratch;
+		settle_nodes(x);
 		assert(x.size() > 0);
 		int nDim = x[0]->dim;
 		if (labelSize != nDim) {
@@ -184,8 +194,8 @@ public:
 
 		int seq_size = x.size();
 
-		NRMat<dtype> maxScores(seq_size, labelSize);
-		NRMat<int> maxLastLabels(seq_size, labelSize);
+		ScratchMat<ltype> maxScores(seq_size, labelSize);
+		ScratchMat<int> maxLastLabels(seq_size, labelSize);
 		maxScores = 0.0; maxLastLabels = -2;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -196,9 +206,9 @@ public:
 				}
 				else {
 					int maxLastLabel = -1;
-					dtype maxscore = 0.0;
+					ltype maxscore = 0.0;
 					for (int j = 0; j < labelSize; ++j) {
-						dtype curscore = T.val[j][i] + x[idx]->val[i] + maxScores[idx - 1][j];
+						ltype curscore = T.val[j][i] + x[idx]->val[i] + maxScores[idx - 1][j];
 						if (maxLastLabel == -1 || curscore > maxscore) {
 							maxLastLabel = j;
 							maxscore = curscore;
@@ -211,7 +221,7 @@ public:
 		}
 
 		y.resize(seq_size);
-		dtype maxFinalScore = maxScores[seq_size - 1][0];
+		ltype maxFinalScore = maxScores[seq_size - 1][0];
 		y[seq_size - 1] = 0;
 		for (int i = 1; i < labelSize; ++i) {
 			if (maxScores[seq_size - 1][i] > maxFinalScore) {
@@ -226,7 +236,11 @@ public:
 
 	}
 
-	inline dtype cost(const vector<PNode>& x, const vector<vector<dtype> >&answer, int batchsize = 1){
+	template<typename S>
+	inline ltype cost(const vector<NodeT<S>*>& x, const vector<vector<dtype> >&answer, int batchsize = 1){
+		ProfileScope scope("CRFMLLoss::cost", 4.0 * x.size() * labelSize * labelSize);
+		ScratchScope scratch;
+		settle_nodes(x);
 		assert(x.size() > 0 && x.size() == answer.size());
 		int nDim = x[0]->dim;
 		if (labelSize != nDim || labelSize != answer[0].size()) {
@@ -236,8 +250,8 @@ public:
 
 		int seq_size = x.size();
 		// comute alpha values
-		NRMat<dtype> alpha(seq_size, labelSize);
-		NRMat<dtype> alpha_answer(seq_size, labelSize);
+		ScratchMat<ltype> alpha(seq_size, labelSize);
+		ScratchMat<ltype> alpha_answer(seq_size, labelSize);
 		alpha = 0.0; alpha_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -264,12 +278,12 @@ public:
 		for (int j = 0; j < labelSize; ++j) {
 			buffer[j] = alpha[seq_size - 1][j];
 		}
-		dtype logZ = logsumexp(buffer);
+		ltype logZ = logsumexp(buffer);
 
 		for (int j = 0; j < labelSize; ++j) {
 			buffer[j] = alpha_answer[seq_size - 1][j];
 		}
-		dtype logZ_answer = logsumexp(buffer);
+		ltype logZ_answer = logsumexp(buffer);
 
 		return (logZ - logZ_answer) / batchsize;
 	}
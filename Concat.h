@@ -22,6 +22,10 @@ public:
 	inline void clearValue(){
 		Node::clearValue();
 	}
+
+	inline bool overwrites() const {
+		return true;
+	}
 	
 	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
 		Node::init(dim, -1, mem);
@@ -139,6 +143,10 @@ protected:
 			return;
 		}
 
+		for (int i = 0; i < nSize; ++i){
+			ins[i]->increase_loc();
+		}
+
 		int offset = 0;
 		for (int i = 0; i < nSize; ++i){
 			for (int idx = 0; idx < inDims[i]; idx++){
@@ -146,10 +154,6 @@ protected:
 			}
 			offset += inDims[i];
 		}
-
-		for (int i = 0; i < nSize; ++i){
-			ins[i]->increase_loc();
-		}
 	}
 
 };
@@ -0,0 +1,114 @@
+#ifndef N3L_DATAPARALLEL_H
+#define N3L_DATAPARALLEL_H
+
+#include "ModelUpdate.h"
+#include "ThreadPool.h"
+
+// synchronous data-parallel training over threads
+// every worker owns a replica of the model: its graph, builders and params.
+// the params of a replica must be exported in the same order as those of the master,
+// they read the values of the master and keep their own gradients.
+// after each mini-batch the gradients of all replicas are reduced into the master,
+// and the master is updated as usual, e.g., by master->updateAdam(maxScale).
+class DataParallelTrainer {
+public:
+	ModelUpdate* _master;
+	vector<ModelUpdate*> _replicas;
+	vector<dtype> _costs;
+	ThreadPool* _pool;
+
+public:
+	DataParallelTrainer() {
+		_master = NULL;
+		_replicas.clear();
+		_pool = NULL;
+	}
+
+	~DataParallelTrainer() {
+		clear();
+	}
+
+	inline void clear() {
+		if (_pool) delete _pool;
+		_pool = NULL;
+		_master = NULL;
+		_replicas.clear();
+		_costs.clear();
+	}
+
+public:
+	inline bool init(ModelUpdate* master, const vector<ModelUpdate*>& replicas) {
+		clear();
+		int paramNum = master->_params.size();
+		for (int idx = 0; idx < replicas.size(); idx++) {
+			if (replicas[idx]->_params.size() != paramNum) {
+				std::cout << "data parallel error: replica " << idx << " has a different number of params" << std::endl;
+				return false;
+			}
+			for (int idy = 0; idy < paramNum; idy++) {
+				BaseParam* param = master->_params[idy];
+				BaseParam* replica = replicas[idx]->_params[idy];
+				if (param->val.row != replica->val.row || param->val.col != replica->val.col) {
+					std::cout << "data parallel error: param " << idy << " of replica " << idx << " does not match" << std::endl;
+					return false;
+				}
+			}
+		}
+
+		_master = master;
+		_replicas = replicas;
+		for (int idx = 0; idx < _replicas.size(); idx++) {
+			for (int idy = 0; idy < paramNum; idy++) {
+				_replicas[idx]->_params[idy]->shareValue(_master->_params[idy]);
+			}
+		}
+		_costs.resize(_replicas.size());
+		_pool = new ThreadPool(_replicas.size());
+		return true;
+	}
+
+	inline int workers() const {
+		return _replicas.size();
+	}
+
+	// func(worker, index) runs forward and backward of example index on the replica of worker,
+	// and returns its cost. examples are distributed over workers in turn.
+	// returns the summed cost, the gradients are reduced into the master.
+	template<typename Func>
+	inline dtype train(int count, Func func) {
+		int nThreads = _replicas.size();
+		_pool->run([&](int worker) {
+			dtype cost = 0.0;
+			for (int idx = worker; idx < count; idx += nThreads) {
+				cost += func(worker, idx);
+			}
+			_costs[worker] = cost;
+		});
+
+		dtype cost = 0.0;
+		for (int idx = 0; idx < nThreads; idx++) {
+			cost += _costs[idx];
+		}
+		reduce();
+		return cost;
+	}
+
+	// each param is reduced by one worker, so no two workers write the same gradient
+	inline void reduce() {
+		int nThreads = _replicas.size();
+		int paramNum = _master->_params.size();
+		_pool->run([&](int worker) {
+			for (int idy = worker; idy < paramNum; idy += nThreads) {
+				BaseParam* param = _master->_params[idy];
+				for (int idx = 0; idx < nThreads; idx++) {
+					BaseParam* replica = _replicas[idx]->_params[idy];
+					param->addGrad(replica);
+					replica->clearGrad();
+				}
+			}
+		});
+	}
+
+};
+
+#endif
@@ -115,6 +115,14 @@ public:
 		inDim4 = param->W4.inDim();
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline double flops() const {
+		return 2.0 * (inDim1 + inDim2 + inDim3 + inDim4) * dim;
+	}
+
 
 	inline void clearValue(){
 		Node::clearValue();
@@ -126,6 +134,10 @@ public:
 		lty.zero();
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 	// define the activation function and its derivation form
 	inline void setFunctions(dtype (*f)(const dtype&), dtype (*f_deri)(const dtype&, const dtype&)) {
 		activate = f;
@@ -135,15 +147,23 @@ public:
 	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
 		Node::init(dim, dropOut, mem);
 		ty.init(dim, mem);
-		lty.init(dim, mem);
+		if (!inference) lty.init(dim, mem);
 	}	
 
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes() + lty.bytes();
+	}
+
 public:
 	void forward(Graph *cg, PNode x1, PNode x2, PNode x3, PNode x4) {
 		in1 = x1;
 		in2 = x2;
 		in3 = x3;
 		in4 = x4;
+		in1->increase_loc();
+		in2->increase_loc();
+		in3->increase_loc();
+		in4->increase_loc();
 
 		ty.mat() = param->W1.val.mat() * in1->val.mat() + param->W2.val.mat() * in2->val.mat() 
 		           + param->W3.val.mat() * in3->val.mat() + param->W4.val.mat() * in4->val.mat();
@@ -152,18 +172,13 @@ public:
 			ty.vec() += param->b.val.vec();
 		}
 		
-		val.vec() = ty.vec().unaryExpr(ptr_fun(activate));
-
-		in1->increase_loc();
-		in2->increase_loc();
-		in3->increase_loc();
-		in4->increase_loc();
+		activate_forward(activate, ty, val);
 
 		cg->addNode(this);
 	}
 
 	void backward() {
-		lty.vec() = loss.vec() * ty.vec().binaryExpr(val.vec(), ptr_fun(derivate));
+		activate_backward(derivate, ty, val, loss, lty, false);
 
 		param->W1.grad.mat() += lty.mat() * in1->val.tmat();
 		param->W2.grad.mat() += lty.mat() * in2->val.tmat();
@@ -227,6 +242,14 @@ public:
 		inDim4 = param->W4.inDim();
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline double flops() const {
+		return 2.0 * (inDim1 + inDim2 + inDim3 + inDim4) * dim;
+	}
+
 
 	inline void clearValue(){
 		Node::clearValue();
@@ -236,6 +259,10 @@ public:
 		in4 = NULL;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 
 public:
 	void forward(Graph *cg, PNode x1, PNode x2, PNode x3, PNode x4) {
@@ -243,6 +270,10 @@ public:
 		in2 = x2;
 		in3 = x3;
 		in4 = x4;
+		in1->increase_loc();
+		in2->increase_loc();
+		in3->increase_loc();
+		in4->increase_loc();
 
 		val.mat() = param->W1.val.mat() * in1->val.mat() + param->W2.val.mat() * in2->val.mat() 
 		           + param->W3.val.mat() * in3->val.mat() + param->W4.val.mat() * in4->val.mat();
@@ -251,11 +282,6 @@ public:
 			val.vec() += param->b.val.vec();
 		}
 		
-		in1->increase_loc();
-		in2->increase_loc();
-		in3->increase_loc();
-		in4->increase_loc();
-
 		cg->addNode(this);
 	}
 
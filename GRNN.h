@@ -32,6 +32,18 @@ struct GRNNParams{
 	inline int outDim(){
 		return _rnn.W2.outDim();
 	}
+
+	inline void save(std::ofstream &os) const {
+		_rnn.save(os);
+		_rnn_update.save(os);
+		_rnn_reset.save(os);
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		_rnn.load(is, mem);
+		_rnn_update.load(is, mem);
+		_rnn_reset.load(is, mem);
+	}
 };
 
 class GRNNBuilder{
@@ -57,6 +69,10 @@ public:
 	GRNNParams* _params;
 	bool _left2right;
 
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+	dtype _dropout;
+
 public:
 	~GRNNBuilder(){
 		clear();
@@ -81,8 +97,20 @@ public:
 			_rnn_nodes[idx].setFunctions(&ftanh, &dtanh);
 		}
 		_left2right = left2right;
-		
-		for (int idx = 0; idx < maxsize; idx++) {
+
+		_capacity = 0;
+		_mem = mem;
+		_dropout = dropout;
+		_bucket_zero.init(_outDim, -1, mem);
+		_bucket_zero.set_bucket();
+		_bucket_one.init(_outDim, -1, mem);
+		_bucket_one.set_bucket();
+		_bucket_one.val = 1.0;
+	}
+
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		return reserveNodes("GRNN", size, _rnn_nodes.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
 			_rnn_update_nodes[idx].init(_outDim, -1, mem);
 			_rnn_reset_nodes[idx].init(_outDim, -1, mem);
 			_rnn_nodes[idx].init(_outDim, -1, mem);
@@ -91,14 +119,15 @@ public:
 			_mult_nodes_1[idx].init(_outDim, -1, mem);
 			_mult_nodes_2[idx].init(_outDim, -1, mem);
 			_add_node[idx].init(_outDim, -1, mem);
-			_output[idx].init(_outDim, dropout, mem);			
-		}
-		
-		_bucket_zero.init(_outDim, -1, mem);
-		_bucket_zero.set_bucket();
-		_bucket_one.init(_outDim, -1, mem);
-		_bucket_one.set_bucket();
-		_bucket_one.val = 1.0;
+			_output[idx].init(_outDim, _dropout, mem);
+		});
+	}
+
+	inline size_t bytes() const {
+		return _bucket_zero.bytes() + _bucket_one.bytes() + nodeBytes(_rnn_update_nodes)
+			+ nodeBytes(_rnn_reset_nodes) + nodeBytes(_y_temp_nodes) + nodeBytes(_sub_nodes)
+			+ nodeBytes(_mult_nodes_1) + nodeBytes(_mult_nodes_2) + nodeBytes(_add_node)
+			+ nodeBytes(_rnn_nodes) + nodeBytes(_output);
 	}
 
 	inline void resize(int maxsize) {
@@ -119,6 +148,9 @@ public:
 		_outDim = 0;
 		_left2right = true;
 		_params = NULL;
+		_capacity = 0;
+		_mem = NULL;
+		_dropout = -1;
 		_rnn_update_nodes.clear();
 		_rnn_reset_nodes.clear();
 		_rnn_nodes.clear();
@@ -140,6 +172,7 @@ public:
 			std::cout << "input dim dose not match for seg operation" << std::endl;
 			return;
 		}
+		if (!reserve(_nSize)) return;
 		if (_left2right)
 			left2right_forward(cg, x);
 		else
@@ -254,6 +287,13 @@ public:
 		_bucket_one.val = 1.0;
 	}
 
+	inline size_t bytes() const {
+		return _bucket_zero.bytes() + _bucket_one.bytes() + _rnn_update_node.bytes()
+			+ _rnn_reset_node.bytes() + _y_temp_node.bytes() + _sub_node.bytes()
+			+ _mult_node_1.bytes() + _mult_node_2.bytes() + _add_node.bytes() + _rnn_node.bytes()
+			+ _output.bytes();
+	}
+
 
 	inline void clear(){
 		_nSize = 0;
@@ -0,0 +1,454 @@
+#ifndef GRUCELL_H_
+#define GRUCELL_H_
+
+#include "MyLib.h"
+#include "Node.h"
+#include "Param.h"
+#include "GRNN.h"
+#include "SeqProj.h"
+#include "Graph.h"
+
+// the params of GRNNParams stacked by rows: the gates W = [W1 W2] of update and reset, i.e., 2H x (H + I), with one bias of 2H,
+// and the candidate C = [W1 W2] of _rnn, H x (H + I). the files are those of GRNNParams, both in load and save,
+// so models of GRNNBuilder run by GRUCellBuilder and back, with their optimizer states.
+struct GRUCellParams {
+	Param W;
+	Param b;
+	Param C;
+	Param c;
+	int nOSize, nISize;
+
+	GRUCellParams() {
+		nOSize = nISize = 0;
+	}
+
+	inline void exportAdaParams(ModelUpdate& ada) {
+		ada.addParam(&W);
+		ada.addParam(&b);
+		ada.addParam(&C);
+		ada.addParam(&c);
+	}
+
+	//drawn as GRNNParams::initial
+	inline void initial(int nOSize, int nISize, AlignedMemoryPool* mem = NULL) {
+		GRNNParams param;
+		param.initial(nOSize, nISize);
+		pack(param, mem);
+	}
+
+	inline int inDim() {
+		return nISize;
+	}
+
+	inline int outDim() {
+		return nOSize;
+	}
+
+	//the values and optimizer states of param, which stays unchanged
+	inline void pack(GRNNParams& param, AlignedMemoryPool* mem = NULL) {
+		nOSize = param.outDim();
+		nISize = param.inDim();
+		W.initial(2 * nOSize, nOSize + nISize, mem);
+		b.initial(2 * nOSize, 1, mem);
+		C.initial(nOSize, nOSize + nISize, mem);
+		c.initial(nOSize, 1, mem);
+		packGate(W, b, param._rnn_update, 0);
+		packGate(W, b, param._rnn_reset, nOSize);
+		packGate(C, c, param._rnn, 0);
+		W.iter = b.iter = C.iter = c.iter = param._rnn.W1.iter;
+	}
+
+	inline void save(std::ofstream &os) const {
+		saveGate(os, C, c, 0);  //_rnn, _rnn_update, _rnn_reset as GRNNParams::save
+		saveGate(os, W, b, 0);
+		saveGate(os, W, b, nOSize);
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		GRNNParams param;
+		param.load(is);
+		pack(param, mem);
+	}
+
+protected:
+	inline void packGate(Param& W, Param& b, const BiParams& gate, int row) {
+		packBlock(W, gate.W1, row, 0);
+		packBlock(W, gate.W2, row, nOSize);
+		packBlock(b, gate.b, row, 0);
+	}
+
+	static inline void packBlock(Param& dst, const Param& src, int row, int col) {
+		dst.val.mat().block(row, col, src.val.row, src.val.col) = src.val.mat();
+		dst.aux_square.mat().block(row, col, src.val.row, src.val.col) = src.aux_square.mat();
+		dst.aux_mean.mat().block(row, col, src.val.row, src.val.col) = src.aux_mean.mat();
+	}
+
+	inline void saveGate(std::ofstream &os, const Param& W, const Param& b, int row) const {
+		os << true << std::endl;
+		saveBlock(os, W, row, 0, nOSize, nOSize);
+		saveBlock(os, W, row, nOSize, nOSize, nISize);
+		saveBlock(os, b, row, 0, nOSize, 1);
+	}
+
+	static inline void saveBlock(std::ofstream &os, const Param& src, int row, int col, int rows, int cols) {
+		Tensor2D block;
+		block.init(rows, cols);
+		block.mat() = src.val.mat().block(row, col, rows, cols);
+		block.save(os);
+		block.mat() = src.aux_square.mat().block(row, col, rows, cols);
+		block.save(os);
+		block.mat() = src.aux_mean.mat().block(row, col, rows, cols);
+		block.save(os);
+		os << src.iter << std::endl;
+	}
+};
+
+// one step of GRNNBuilder fused in one node: the update and reset gates by one GEMV of the stacked W,
+// the candidate by one GEMV of C on [reset * hidden; x], and the output in the same pass; the backward likewise.
+// val is the output, and the previous step is the only recurrent input.
+// given SeqProjNodes of W[:, H:] and C[:, H:], the step takes their columns in place of the products with x.
+struct GRUCellNode : Node {
+public:
+	GRUCellNode* prev;  //NULL for the first step
+	PNode in;  //x, or the projection of W
+	SeqProjNode* proj;
+	SeqProjNode* cproj;  //the projection of C
+	int step;
+	Tensor1D hx, rhx;  //[hidden of prev; x], [reset * hidden of prev; x]
+	Tensor1D gates;  //update, reset after activation
+	Tensor1D cand;  //candidate after activation
+	Tensor1D lgates, lcand, lhx, lrhx;
+
+	GRUCellParams* param;
+	int inDim;
+
+public:
+	GRUCellNode() : Node() {
+		prev = NULL;
+		in = NULL;
+		proj = cproj = NULL;
+		step = 0;
+		param = NULL;
+		inDim = 0;
+	}
+
+	inline void setParam(GRUCellParams* paramInit) {
+		param = paramInit;
+		inDim = param->nISize;
+	}
+
+	inline double flops() const {
+		return proj ? 6.0 * dim * dim : 6.0 * dim * (dim + inDim);
+	}
+
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline void clearValue() {
+		Node::clearValue();
+		prev = NULL;
+		in = NULL;
+		proj = cproj = NULL;
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	//setParam first
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL) {
+		Node::init(dim, dropOut, mem);
+		hx.init(dim + inDim, mem);
+		rhx.init(dim + inDim, mem);
+		gates.init(2 * dim, mem);
+		cand.init(dim, mem);
+		if (inference) return;
+		lgates.init(2 * dim, mem);
+		lcand.init(dim, mem);
+		lhx.init(dim + inDim, mem);
+		lrhx.init(dim + inDim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + hx.bytes() + rhx.bytes() + gates.bytes() + cand.bytes()
+			+ lgates.bytes() + lcand.bytes() + lhx.bytes() + lrhx.bytes();
+	}
+
+public:
+	void forward(Graph *cg, GRUCellNode* last, PNode x) {
+		prev = last;
+		in = x;
+		proj = cproj = NULL;
+		if (prev) {
+			cg->require(prev);
+			prev->increase_loc();
+		}
+		cg->require(in);
+		in->increase_loc();
+
+		compute();
+		cg->addNode(this);
+	}
+
+	//the input sides are column t of p and cp, which are run before
+	void forward(Graph *cg, GRUCellNode* last, SeqProjNode* p, SeqProjNode* cp, int t) {
+		link(last, p, cp, t);
+		acquire(cg);
+		compute();
+		cg->addNode(this);
+	}
+
+	//the inputs only, compute and acquire are left to the caller, see BiCell.h
+	inline void link(GRUCellNode* last, SeqProjNode* p, SeqProjNode* cp, int t) {
+		prev = last;
+		in = p;
+		proj = p;
+		cproj = cp;
+		step = t;
+	}
+
+	inline void acquire(Graph *cg) {
+		if (prev) {
+			cg->require(prev);
+			prev->increase_loc();
+		}
+		cg->require(proj);
+		proj->increase_loc();
+		cg->require(cproj);
+		cproj->increase_loc();
+	}
+
+	inline void compute() {
+		VecT<dtype> h(hx.v, dim), x(hx.v + dim, inDim), rh(rhx.v, dim), rx(rhx.v + dim, inDim);
+		if (prev) h = prev->val.vec();
+		else h.setZero();
+
+		if (proj) {
+			gates.mat().noalias() = param->W.val.mat().leftCols(dim) * MatT<dtype>(hx.v, dim, 1);
+			gates.vec() += VecT<dtype>(proj->column(step), 2 * dim);
+		}
+		else {
+			x = in->val.vec();
+			gates.mat().noalias() = param->W.val.mat() * hx.mat();
+		}
+		gates.vec() += param->b.val.vec();
+		activate_forward(fsigmoid, gates, gates);
+
+		VecT<dtype> z(gates.v, dim), r(gates.v + dim, dim);
+		rh = r * h;
+		if (proj) {
+			cand.mat().noalias() = param->C.val.mat().leftCols(dim) * MatT<dtype>(rhx.v, dim, 1);
+			cand.vec() += VecT<dtype>(cproj->column(step), dim);
+		}
+		else {
+			rx = x;
+			cand.mat().noalias() = param->C.val.mat() * rhx.mat();
+		}
+		cand.vec() += param->c.val.vec();
+		activate_forward(ftanh, cand, cand);
+
+		val.vec() = (z.constant(1) - z) * h + z * cand.vec();
+	}
+
+	void backward() {
+		VecT<dtype> z(gates.v, dim), r(gates.v + dim, dim), h(hx.v, dim);
+		VecT<dtype> lz(lgates.v, dim), lr(lgates.v + dim, dim), lrh(lrhx.v, dim);
+		VecT<dtype> n = cand.vec();
+
+		lcand.vec() = loss.vec() * z * (n.constant(1) + n) * (n.constant(1) - n);
+		param->c.grad.vec() += lcand.vec();
+		lz = loss.vec() * (n - h) * (z.constant(1) - z) * z;
+		if (proj) {
+			VecT<dtype>(cproj->lossColumn(step), dim) += lcand.vec();
+			if (!prev) {
+				lr.setZero();  //h = 0
+				param->b.grad.vec() += lgates.vec();
+				VecT<dtype>(proj->lossColumn(step), 2 * dim) += lgates.vec();
+				return;
+			}
+			param->C.grad.mat().leftCols(dim).noalias() += lcand.mat() * MatT<dtype>(rhx.v, dim, 1).transpose();
+			MatT<dtype>(lrhx.v, dim, 1).noalias() = param->C.val.mat().leftCols(dim).transpose() * lcand.mat();
+			lr = lrh * h * (r.constant(1) - r) * r;
+			param->b.grad.vec() += lgates.vec();
+			VecT<dtype>(proj->lossColumn(step), 2 * dim) += lgates.vec();
+			param->W.grad.mat().leftCols(dim).noalias() += lgates.mat() * MatT<dtype>(hx.v, dim, 1).transpose();
+			MatT<dtype>(lhx.v, dim, 1).noalias() = param->W.val.mat().leftCols(dim).transpose() * lgates.mat();
+			prev->loss.vec() += VecT<dtype>(lhx.v, dim) + lrh * r + loss.vec() * (z.constant(1) - z);
+			return;
+		}
+
+		param->C.grad.mat().noalias() += lcand.mat() * rhx.tmat();
+		lrhx.mat().noalias() = param->C.val.mat().transpose() * lcand.mat();
+		lr = lrh * h * (r.constant(1) - r) * r;
+		param->W.grad.mat().noalias() += lgates.mat() * hx.tmat();
+		param->b.grad.vec() += lgates.vec();
+		lhx.mat().noalias() = param->W.val.mat().transpose() * lgates.mat();
+
+		in->loss.vec() += VecT<dtype>(lhx.v + dim, inDim) + VecT<dtype>(lrhx.v + dim, inDim);
+		if (prev) prev->loss.vec() += VecT<dtype>(lhx.v, dim) + lrh * r + loss.vec() * (z.constant(1) - z);
+	}
+
+	inline void unlock() {
+		if (prev) prev->decrease_loc();
+		in->decrease_loc();
+		if (cproj) cproj->decrease_loc();
+		if (!lossed) return;
+		if (prev) prev->lossed = true;
+		in->lossed = true;
+		if (cproj) cproj->lossed = true;
+	}
+};
+
+// GRNNBuilder by fused steps, the outputs are in _output as before
+class GRUCellBuilder {
+public:
+	int _nSize;
+	int _inDim;
+	int _outDim;
+
+	vector<GRUCellNode> _output;
+	SeqProjNode _proj, _cproj;  //W[:, H:] and C[:, H:] of all the inputs, before the steps
+
+	GRUCellParams* _params;
+	bool _left2right;
+
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+	dtype _dropout;
+
+public:
+	~GRUCellBuilder(){
+		clear();
+	}
+
+	GRUCellBuilder(){
+		clear();
+	}
+
+public:
+	inline void init(GRUCellParams* paramInit, dtype dropout, bool left2right = true, AlignedMemoryPool* mem = NULL) {
+		_params = paramInit;
+		_inDim = _params->inDim();
+		_outDim = _params->outDim();
+		int maxsize = _output.size();
+		for (int idx = 0; idx < maxsize; idx++) {
+			_output[idx].setParam(_params);
+		}
+		_left2right = left2right;
+		_proj.init(&_params->W, _outDim, _inDim, maxsize, mem);
+		_cproj.init(&_params->C, _outDim, _inDim, maxsize, mem);
+
+		_capacity = 0;
+		_mem = mem;
+		_dropout = dropout;
+	}
+
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		if (!reserveNodes("GRU cell", size, _output.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
+			_output[idx].init(_outDim, _dropout, mem);
+		})) return false;
+		_proj.reserve(_capacity);
+		_cproj.reserve(_capacity);
+		return true;
+	}
+
+	inline size_t bytes() const {
+		return nodeBytes(_output) + _proj.bytes() + _cproj.bytes();
+	}
+
+	inline void resize(int maxsize){
+		_output.resize(maxsize);
+	}
+
+	inline void clear(){
+		_output.clear();
+
+		_left2right = true;
+		_params = NULL;
+		_nSize = 0;
+		_inDim = 0;
+		_outDim = 0;
+		_capacity = 0;
+		_mem = NULL;
+		_dropout = -1;
+	}
+
+public:
+	inline void forward(Graph *cg, const vector<PNode>& x){
+		if (x.size() == 0){
+			std::cout << "empty inputs for GRU operation" << std::endl;
+			return;
+		}
+
+		_nSize = x.size();
+		if (x[0]->val.dim != _inDim){
+			std::cout << "input dim does not match for GRU operation" << std::endl;
+			return;
+		}
+		if (!reserve(_nSize)) return;
+
+		_proj.forward(cg, x);
+		_cproj.forward(cg, x);
+		if (_left2right) {
+			for (int idx = 0; idx < _nSize; idx++) {
+				_output[idx].forward(cg, idx == 0 ? NULL : &_output[idx - 1], &_proj, &_cproj, idx);
+			}
+		}
+		else {
+			for (int idx = _nSize - 1; idx >= 0; idx--) {
+				_output[idx].forward(cg, idx == _nSize - 1 ? NULL : &_output[idx + 1], &_proj, &_cproj, idx);
+			}
+		}
+	}
+};
+
+// IncGRNNBuilder by one fused step
+class IncGRUCellBuilder{
+public:
+	int _nSize;
+	int _inDim;
+	int _outDim;
+
+	GRUCellNode _output;
+
+	GRUCellParams* _params;
+
+public:
+	~IncGRUCellBuilder(){
+		clear();
+	}
+
+	IncGRUCellBuilder(){
+		clear();
+	}
+
+public:
+	inline void init(GRUCellParams* paramInit, dtype dropout, AlignedMemoryPool* mem = NULL) {
+		_params = paramInit;
+		_inDim = _params->inDim();
+		_outDim = _params->outDim();
+
+		_output.setParam(_params);
+		_output.init(_outDim, dropout, mem);
+	}
+
+	inline size_t bytes() const {
+		return _output.bytes();
+	}
+
+	inline void clear(){
+		_nSize = 0;
+		_inDim = 0;
+		_outDim = 0;
+		_params = NULL;
+	}
+
+public:
+	inline void left2right_forward(Graph *cg, PNode x, IncGRUCellBuilder* prev = NULL) {
+		_output.forward(cg, prev == NULL ? NULL : &prev->_output, x);
+	}
+};
+
+#endif
@@ -43,6 +43,11 @@ public:
 
 	GatedPoolParam* _param;
 
+	vector<PNode> _gate_nodes, _mul_nodes;
+
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+
 	GatedPoolBuilder(){
 		clear();
 	}
@@ -53,6 +58,8 @@ public:
 
 	inline void clear(){
 		_uni_gate.clear();
+		_capacity = 0;
+		_mem = NULL;
 	}
 
 	inline void resize(int maxsize){
@@ -68,14 +75,25 @@ public:
 		_outDim = _param->outDim();
 		for (int idx = 0; idx < maxsize; idx++) {
 			_uni_gate[idx].setParam(&_param->_uni_gate_param);
-			_uni_gate[idx].init(_outDim, -1, mem);
 		}
+		_capacity = 0;
+		_mem = mem;
 		_softmax_project.init(_outDim, mem);
-		for (int idx = 0; idx < maxsize; idx++)
-			_mul[idx].init(_outDim, -1, mem);
 		_output.init(_outDim, -1, mem);
 	}
 
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		return reserveNodes("gated pooling", size, _uni_gate.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
+			_uni_gate[idx].init(_outDim, -1, mem);
+			_mul[idx].init(_outDim, -1, mem);
+		});
+	}
+
+	inline size_t bytes() const {
+		return nodeBytes(_uni_gate) + _softmax_project.bytes() + nodeBytes(_mul) + _output.bytes();
+	}
+
 	inline void forward(Graph *cg, const vector<PNode>& x){
 		if (x.size() == 0) {
 			std::cout << "empty inputs for GatedPoolBuilder operation" << std::endl;
@@ -86,12 +104,19 @@ public:
 			std::cout << "input dim does not for GatedPoolBuilder operation" << std::endl;
 			return;
 		}
+		if (!reserve(_nSize)) return;
+		bool batched = cg->batched;
+		cg->batched = true;
 		for (int idx = 0; idx < _nSize; idx++)
 			_uni_gate[idx].forward(cg, x[idx]);
-		_softmax_project.forward(cg, getPNodes(_uni_gate, _nSize));
+		cg->flush();
+		cg->batched = batched;
+		getPNodes(_uni_gate, _nSize, _gate_nodes);
+		_softmax_project.forward(cg, _gate_nodes);
 		for (int idx = 0; idx < _nSize; idx++)
 			_mul[idx].forward(cg, &_softmax_project._output[idx], &_uni_gate[idx]);
-		_output.forward(cg, getPNodes(_mul, _nSize));
+		getPNodes(_mul, _nSize, _mul_nodes);
+		_output.forward(cg, _mul_nodes);
 	}
 };
 
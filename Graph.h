@@ -1,45 +1,251 @@
 #ifndef BasicGraph
 #define BasicGraph
 
+#include <typeinfo>
+#include <map>
+#include <atomic>
 #include "Eigen/Dense"
 #include "Node.h"
 #include "MyLib.h"
+#include "Profiler.h"
+#include "MemoryPlan.h"
+#include "ParallelBackward.h"
+#include "ScratchArena.h"
 
 using namespace Eigen;
 
+// the recorded execution of a graph whose topology is fixed by its key and length
+template<typename T>
+struct GraphPlanT {
+	typedef NodeT<T>* PNode;
+
+	vector<PNode> execs;
+	vector<int> batch_begins;
+	vector<bool> roots;  // nodes lossed before backward, i.e., by the loss functions
+	vector<vector<PNode> > steps;  // backward in order, one lossed node or the lossed nodes of one batch each
+	bool complete;  // the backward has been recorded
+
+	GraphPlanT(){
+		complete = false;
+	}
+};
+
 // one Node means a vector
 // the col should be 1, because we aimed for NLP only
-struct Graph {
+// a graph of the nodes of one scalar type, Graph holds those of dtype
+template<typename T>
+struct GraphT : DeferredQueue, InputTrackerT<T> {
+public:
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
 
 public:
 	bool train;
+	bool batched; //defer batchable nodes until flush
+	// clear the graph in O(1) by a new epoch: nodes whose forward overwrites their values
+	// (see Node::overwrites) are reset by their first addNode in the epoch, only the others
+	// are cleared by clearValue. the values of the former are not zeroed between examples.
+	bool lazy;
+	// for inference only, by inference_only() of the thread creating it. execs are not kept, as there is
+	// no backward: the nodes are reset by epoch as in the lazy mode. the values are released by memory plans.
+	bool inference;
 protected:
 	vector<PNode> execs; //backward
+	vector<int> batch_begins; //the first exec index of the batch each exec belongs to
+	vector<PNode> pending; //deferred nodes, not computed yet
+	vector<PNode> dirty; //nodes to be cleared by clearValue in the lazy mode
+	unsigned epoch;
 	//vector<PNode> exports; //backward
 
+	map<pair<const void*, int>, GraphPlanT<T> > plans;
+	GraphPlanT<T>* plan; //the plan of the current example, recorded or replayed
+	bool replay; //execs are not built, they are checked against plan->execs
+	int plan_pos;
+
+	map<pair<const void*, int>, MemoryPlanT<T> > memplans;
+	MemoryPlanT<T>* memplan; //the memory plan of the current example, recorded or bound
+	bool memrecord;
+	int mem_pos;
+	vector<PNode> reads; //inputs read since the last addNode, by input_tracker
+	AlignedMemoryPool* mempool; //for the slabs of memory plans
+
+	vector<vector<PNode> > exec_inputs; //inputs of each exec, tracked for the parallel backward
+	bool tracked; //no node has been deferred, whose inputs would be mixed up
+	ParallelBackwardT<T> parallel;
+
+public:
+	Profiler* profiler; //opt-in, NULL by default
+	// opt-in, backward over the workers of the pool, set it before clearValue.
+	// the inputs of the nodes are tracked in forward for it. graphs with batched or
+	// replayed execution, a plan being recorded, or a profiler, still run backward serially.
+	ThreadPool* backward_pool;
+
 public:
-	Graph(){
+	GraphT(){
 		execs.clear();
+		batch_begins.clear();
+		pending.clear();
+		batched = false;
+		lazy = false;
+		inference = inference_only();
+		epoch = nextEpoch();
+		plan = NULL;
+		replay = false;
+		plan_pos = 0;
+		memplan = NULL;
+		memrecord = false;
+		mem_pos = 0;
+		mempool = NULL;
+		profiler = NULL;
+		backward_pool = NULL;
+		tracked = true;
 		//exports.clear();
 	}
 
+	~GraphT(){
+		clearMemoryPlans();
+		if (profiler && Profiler::current() == profiler) Profiler::current() = NULL;
+	}
+
 public:
 	inline void clearValue(const bool& bTrain = false){
-		int count = execs.size();
+		int count = pending.size();
+		for (int idx = 0; idx < count; idx++){
+			pending[idx]->clearValue();
+		}
+		pending.clear();
+		if (lazy || inference){
+			count = dirty.size();
+			for (int idx = 0; idx < count; idx++){
+				dirty[idx]->clearValue();
+			}
+			dirty.clear();
+			epoch = nextEpoch();
+		}
+		else if (replay){
+			for (int idx = 0; idx < plan_pos; idx++){
+				plan->execs[idx]->clearValue();
+			}
+		}
+		count = (lazy || inference) ? 0 : execs.size();
 		for (int idx = 0; idx < count; idx++){
 			execs[idx]->clearValue();
 		}
 		execs.clear();
+		batch_begins.clear();
+		plan = NULL;
+		replay = false;
+		plan_pos = 0;
+		if (memplan){
+			if (memrecord){
+				input_tracker<T>() = NULL;
+				memplan->build(mempool);
+			}
+			else{
+				memplan->unbind();
+			}
+			memplan = NULL;
+		}
+		exec_inputs.clear();
+		tracked = true;
+		reads.clear();
+		ScratchArena::local().reset();
+		input_tracker<T>() = backward_pool ? this : NULL;
 		//exports.clear();
 		train = bTrain;
+		Profiler::current() = profiler;
+		if (profiler) profiler->lap();
+	}
+
+	// declare that the graph of this example has the same topology as all the other examples
+	// with the same key and length, e.g., the model (or builder) and the sentence length.
+	// call it after clearValue and before forward. the first example records the exec order
+	// and the backward steps, the later ones check their execs against the order instead of keeping them,
+	// and run the recorded steps in backward without its lock checks and unlock calls. the forward still
+	// counts the locks, as they are needed once a mismatch falls back to the normal execution, and each
+	// step is still a virtual backward (or backward_batch) of its node. the plan is recorded again then.
+	inline void usePlan(const void* key, int length){
+		plan = &plans[make_pair(key, length)];
+		replay = plan->complete;
+		plan_pos = 0;
+	}
+
+	// share the node values of this example by their lifetimes, for inference only.
+	// the graph must be fixed by the key and length as in usePlan, and the nodes be computed
+	// one by one (no batching). call it after clearValue and before setting any input value.
+	// the first example records the inputs of each node, then the slab is allocated from mem
+	// (or the heap) and the later examples compute in it. only the values of the outputs,
+	// i.e., nodes without consumers, are kept after forward, until the next clearValue.
+	// a plan whose values have grown since, e.g., by a longer example, is recorded again.
+	inline void useMemoryPlan(const void* key, int length, AlignedMemoryPool* mem = NULL){
+		if (!inference){
+			std::cout << "graph warning: memory plans are for inference only" << std::endl;
+			return;
+		}
+		memplan = &memplans[make_pair(key, length)];
+		mem_pos = 0;
+		mempool = mem;
+		memrecord = !memplan->complete || !memplan->fits();
+		reads.clear();
+		input_tracker<T>() = this;
+		if (memrecord){
+			memplan->reset();
+		}
+		else{
+			memplan->bind();
+		}
+	}
+
+	inline void clearMemoryPlans(){
+		if (memplan && !memrecord) memplan->unbind();
+		if (memplan) input_tracker<T>() = backward_pool ? this : NULL;
+		memplan = NULL;
+		memplans.clear();
+	}
+
+	inline void clearPlans(){
+		if (replay) abandonPlan();
+		plan = NULL;
+		plans.clear();
 	}
 
 	inline void backward(){
+		flush();
+		if (inference){
+			std::cout << "graph error: backward is not available for inference only" << std::endl;
+			return;
+		}
+		if (replay){
+			if (replayBackward()) return;
+			abandonPlan();
+		}
+		bool recording = (plan != NULL);
+		if (recording){
+			plan->complete = false;
+			plan->execs = execs;
+			plan->batch_begins = batch_begins;
+			plan->roots.resize(execs.size());
+			for (int idx = 0; idx < execs.size(); idx++){
+				plan->roots[idx] = execs[idx]->lossed;
+			}
+			plan->steps.clear();
+		}
+
 		int count = execs.size();
+		vector<bool> done;
+		if (!recording && parallelizable()){
+			parallel.run(execs, exec_inputs, *backward_pool, done);
+		}
 		for (int idx = count - 1; idx >= 0; idx--){
+			if (done.size() > 0 && done[idx]) continue;
+			if (batch_begins[idx] < idx){
+				idx = backward_batch(batch_begins[idx], idx);
+				continue;
+			}
 			//
 			if (execs[idx]->lock > 0){
 				execs[idx]->backward();
+				if (recording) plan->steps.push_back(vector<PNode>(1, execs[idx]));
 				std::cout << "bug exists, please check: " << execs[idx]->sid << " " << execs[idx]->lock << std::endl;
 				continue;  // impossible.....
 			}
@@ -47,7 +253,9 @@ public:
 				if (execs[idx]->lossed){
 					//std::cout << "checking: " << execs[idx]->sid << " " << execs[idx]->lock << std::endl;
 					execs[idx]->applydrop_backward();
-					execs[idx]->backward();
+					if (profiler) profileBackward(execs[idx]);
+					else execs[idx]->backward();
+					if (recording) plan->steps.push_back(vector<PNode>(1, execs[idx]));
 				}
 				execs[idx]->unlock();
 			}
@@ -56,26 +264,141 @@ public:
 				//execs[idx]->backward();
 			}
 		}
+
+		if (recording) plan->complete = true;
 	}
 
-	inline void addNode(PNode x){
+	//an input read by the node being built, by increase_loc.
+	//a bound memory plan is abandoned at the first read it does not expect, i.e., before the node
+	//computes in a slice that may be live, and a value it has released can not be given back
+	inline void read(Node* x){
+		reads.push_back(x);
+		if (!memplan || memrecord || memplan->expects(mem_pos, reads)) return;
+		if (memplan->released(mem_pos, x)){
+			std::cout << "graph warning: a node reads a value released by the memory plan, id = " << x->sid << std::endl;
+		}
+		memplan->abandon(mem_pos, NULL);
+		memplan = NULL;
+		if (!backward_pool) input_tracker<T>() = NULL;
+	}
+
+	//nodes may be computed before their addNode, e.g., on other threads as in BiCell.h, but not with
+	//a memory plan, which shares the values by the order of addNode, nor a profiler, which times the forward by it
+	inline bool detachable() const {
+		return memplan == NULL && profiler == NULL;
+	}
+
+	//dropped: the dropout of x has been applied by applydrop_drawn, e.g., computed on another thread
+	inline void addNode(PNode x, bool dropped = false){
+		if ((lazy || inference) && x->epoch != epoch){
+			x->epoch = epoch;
+			if (x->overwrites()){
+				x->executed = false;
+				x->reuse();
+			}
+			else{
+				dirty.push_back(x);
+			}
+		}
         if (x->executed) {
             std::cout << "serious bug here: one node is excuted more than once, id = " << x->sid << std::endl;
             return;
         }
 		x->executed = true;
-		x->applydrop_forward(train);
-		execs.push_back(x);
+		if (!dropped) x->applydrop_forward(train);
+		if (profiler) profiler->forward(x);
 
 		//check randomly
-		int point = rand() % x->dim;
-		if (std::isnan(x->val[point])) {
-			std::cout << "debug" << std::endl;
+		if (!inference){
+			int point = thread_rand() % x->dim;
+			if (std::isnan(x->val[point])) {
+				std::cout << "debug" << std::endl;
+			}
+		}
+
+		if (memplan){
+			if (memrecord){
+				memplan->record(x, reads);
+			}
+			else if (mem_pos < memplan->execs.size() && memplan->execs[mem_pos] == x && memplan->fits(mem_pos)){
+				memplan->release(mem_pos++);
+				if (!backward_pool) reads.clear();
+			}
+			else{
+				memplan->abandon(mem_pos, x);
+				memplan = NULL;
+				if (!backward_pool) input_tracker<T>() = NULL;
+			}
+		}
+
+		if (replay){
+			if (plan_pos < plan->execs.size() && plan->execs[plan_pos] == x){
+				plan_pos++;
+				return;
+			}
+			abandonPlan();
+		}
+		if (inference){
+			reads.clear();
+			return;
+		}
+		batch_begins.push_back(execs.size());
+		execs.push_back(x);
+		if (backward_pool){
+			exec_inputs.push_back(reads);
+			reads.clear();
 		}
 		//std::cout << "for" << x->sid << std::endl;
 			
 	}
 
+	//inputs of a node must be computed before it is deferred or computed, increase_loc does it as well
+	inline void require(PNode x){
+		x->settle();
+	}
+
+	//returns false if the node should be computed right now
+	inline bool defer(PNode x){
+		if (!batched || memplan) return false;
+		tracked = false;
+		x->pending = true;
+		x->queue = this;
+		pending.push_back(x);
+		return true;
+	}
+
+	//compute the deferred nodes, one call for each group of the same type and parameters.
+	//a node reading one of them calls it by increase_loc, see Node::settle
+	inline void flush(){
+		int count = pending.size();
+		if (count == 0) return;
+		vector<vector<PNode> > groups;
+		for (int idx = 0; idx < count; idx++){
+			PNode x = pending[idx];
+			int idy = 0;
+			for (; idy < groups.size(); idy++){
+				PNode head = groups[idy][0];
+				if (head->paramKey() == x->paramKey() && typeid(*head) == typeid(*x)) break;
+			}
+			if (idy == groups.size()) groups.push_back(vector<PNode>());
+			groups[idy].push_back(x);
+		}
+		pending.clear();
+
+		for (int idx = 0; idx < groups.size(); idx++){
+			vector<PNode>& batch = groups[idx];
+			if (profiler) profiler->lap();
+			batch[0]->forward_batch(batch);
+			if (profiler) profiler->shareForward(batch.size());
+			int begin = replay ? plan_pos : execs.size();
+			for (int idy = 0; idy < batch.size(); idy++){
+				batch[idy]->pending = false;
+				addNode(batch[idy]);
+				if (!replay && !inference) batch_begins.back() = begin;
+			}
+		}
+	}
+
 	//some nodes are exported for output, define them
 	//root nodes not aiming for outputs are not allowed
 	//inline void exportNode(PNode x){
@@ -83,9 +406,103 @@ public:
 		//exports.push_back(x);
 	//}
 
+protected:
+	//execs[begin, end] were computed as one batch, returns begin
+	inline int backward_batch(int begin, int end){
+		vector<PNode> batch;
+		for (int idx = end; idx >= begin; idx--){
+			if (execs[idx]->lock != 0){
+				std::cout << "bug exists, please check: " << execs[idx]->sid << " " << execs[idx]->lock << std::endl;
+			}
+			if (execs[idx]->lossed){
+				execs[idx]->applydrop_backward();
+				batch.push_back(execs[idx]);
+			}
+		}
+		if (batch.size() > 0){
+			if (profiler) profileBackward(batch);
+			else batch[0]->backward_batch(batch);
+			if (plan != NULL) plan->steps.push_back(batch);
+		}
+		for (int idx = end; idx >= begin; idx--){
+			execs[idx]->unlock();
+		}
+		return begin;
+	}
+
+	//unique over graphs, so a node tells whether it has been reset for the current epoch
+	static inline unsigned nextEpoch(){
+		static std::atomic<unsigned> next(1);
+		return next++;
+	}
+
+	//every exec is tracked and computed alone
+	inline bool parallelizable() const {
+		if (backward_pool == NULL || profiler != NULL || backward_pool->size() < 2) return false;
+		if (!tracked || exec_inputs.size() != execs.size()) return false;
+		for (int idx = 0; idx < batch_begins.size(); idx++){
+			if (batch_begins[idx] != idx) return false;
+		}
+		return true;
+	}
+
+	//the steps are valid only if the whole forward and the losses match the recorded ones
+	inline bool replayBackward(){
+		int count = plan->execs.size();
+		if (plan_pos != count) return false;
+		for (int idx = 0; idx < count; idx++){
+			if (plan->execs[idx]->lossed != plan->roots[idx]) return false;
+		}
+
+		count = plan->steps.size();
+		for (int idx = 0; idx < count; idx++){
+			vector<PNode>& step = plan->steps[idx];
+			for (int idy = 0; idy < step.size(); idy++){
+				step[idy]->applydrop_backward();
+			}
+			if (profiler){
+				if (step.size() == 1) profileBackward(step[0]);
+				else profileBackward(step);
+			}
+			else if (step.size() == 1){
+				step[0]->backward();
+			}
+			else{
+				step[0]->backward_batch(step);
+			}
+		}
+		return true;
+	}
+
+	inline void profileBackward(PNode x){
+		double start = profiler->now();
+		x->backward();
+		profiler->backward(x, profiler->now() - start);
+	}
+
+	inline void profileBackward(const vector<PNode>& batch){
+		double start = profiler->now();
+		batch[0]->backward_batch(batch);
+		profiler->backward(batch, profiler->now() - start);
+	}
+
+	//continue with the normal execution, the plan will be recorded by the next backward
+	inline void abandonPlan(){
+		execs.assign(plan->execs.begin(), plan->execs.begin() + plan_pos);
+		batch_begins.assign(plan->batch_begins.begin(), plan->batch_begins.begin() + plan_pos);
+		plan->complete = false;
+		replay = false;
+	}
+
 public: // virtual functions
 	virtual inline void clear(){
 		execs.clear();
+		batch_begins.clear();
+		pending.clear();
+		plan = NULL;
+		replay = false;
+		plan_pos = 0;
+		exec_inputs.clear();
 	}
 	//virtual inline void createNodes(...) = 0; // create nodes, as large as possible
 	//virtual inline void initial(...) = 0;  // initial params
@@ -93,12 +510,19 @@ public: // virtual functions
 
 };
 
+typedef GraphT<dtype> Graph;
+typedef GraphPlanT<dtype> GraphPlan;
+
+// the pointer to the base of a derived node, of its scalar type
+template<typename DerivedNode>
+using PNodeOf = NodeT<typename DerivedNode::Scalar>*;
+
 // one very useful function to collect pointers of derived nodes
 template<typename DerivedNode>
-inline vector<PNode> getPNodes(vector<DerivedNode>& inputs, int size){
+inline vector<PNodeOf<DerivedNode> > getPNodes(vector<DerivedNode>& inputs, int size){
 	int usedSize = inputs.size();
 	if (size >= 0 && size < usedSize) usedSize = size;
-	vector<PNode> pnodes;
+	vector<PNodeOf<DerivedNode> > pnodes;
 	for (int idx = 0; idx < usedSize; idx++){
 		pnodes.push_back(&(inputs[idx]));
 	}
@@ -106,12 +530,23 @@ inline vector<PNode> getPNodes(vector<DerivedNode>& inputs, int size){
 	return pnodes;
 }
 
+// the same, but into pnodes, e.g., a member of a builder, whose memory is kept over examples
+template<typename DerivedNode>
+inline void getPNodes(vector<DerivedNode>& inputs, int size, vector<PNodeOf<DerivedNode> >& pnodes){
+	int usedSize = inputs.size();
+	if (size >= 0 && size < usedSize) usedSize = size;
+	pnodes.resize(usedSize);
+	for (int idx = 0; idx < usedSize; idx++){
+		pnodes[idx] = &(inputs[idx]);
+	}
+}
+
 template<typename DerivedNode>
-inline vector<PNode> getPNodes(DerivedNode inputs[], int size){
+inline vector<PNodeOf<DerivedNode> > getPNodes(DerivedNode inputs[], int size){
 	//int usedSize = inputs.;
 	//if (size >= 0 && size < usedSize) usedSize = size;
 	int usedSize = size;
-	vector<PNode> pnodes;
+	vector<PNodeOf<DerivedNode> > pnodes;
 	for (int idx = 0; idx < usedSize; idx++){
 		pnodes.push_back(&(inputs[idx]));
 	}
@@ -120,14 +555,14 @@ inline vector<PNode> getPNodes(DerivedNode inputs[], int size){
 }
 
 template<typename DerivedNode>
-inline vector<PNode> getPNodes(vector<DerivedNode>& inputs, int start, int length){
+inline vector<PNodeOf<DerivedNode> > getPNodes(vector<DerivedNode>& inputs, int start, int length){
 	int end, tmp_end = start + length;
 	if (tmp_end > inputs.size())
 		end = inputs.size();
 	else
 		end = tmp_end;
 	//if (size >= 0 && size < usedSize) usedSize = size;
-	vector<PNode> pnodes;
+	vector<PNodeOf<DerivedNode> > pnodes;
 	for (int idx = start; idx < end; idx++){
 		pnodes.push_back(&(inputs[idx]));
 	}
@@ -136,14 +571,14 @@ inline vector<PNode> getPNodes(vector<DerivedNode>& inputs, int start, int lengt
 }
 
 template<typename DerivedNode>
-inline vector<PNode> getPNodes(DerivedNode inputs[], int size, int start, int length){
+inline vector<PNodeOf<DerivedNode> > getPNodes(DerivedNode inputs[], int size, int start, int length){
 	int end, tmp_end = start + length;
 	if (tmp_end > size)
 		end = size;
 	else
 		end = tmp_end;
 	//if (size >= 0 && size < usedSize) usedSize = size;
-	vector<PNode> pnodes;
+	vector<PNodeOf<DerivedNode> > pnodes;
 	for (int idx = start; idx < end; idx++){
 		pnodes.push_back(&(inputs[idx]));
 	}
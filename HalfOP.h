@@ -0,0 +1,497 @@
+#ifndef N3L_HALFOP_H
+#define N3L_HALFOP_H
+
+#include "HalfParam.h"
+#include "UniOP.h"
+#include "BiOP.h"
+#include "TriOP.h"
+#include "LookupTable.h"
+
+// frozen copies of UniParams, BiParams, TriParams and LookupTable in bf16 or fp16, with nodes for inference.
+// a trained model is frozen by freeze(), or its saved file is read by loadTrained() without keeping the optimizer states.
+// the nodes compute forward only, and backward does nothing.
+//	HalfUniParams hidden;
+//	hidden.freeze(model.hidden, HALF_BF16);
+//	HalfUniNode node;
+//	node.setParam(&hidden);
+//	node.init(hidden.W.outDim(), -1);
+struct HalfUniParams {
+public:
+	HalfParam W;
+	HalfParam b;
+	bool bUseB;
+
+public:
+	HalfUniParams() {
+		bUseB = true;
+	}
+
+	inline void freeze(const UniParams& param, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		bUseB = param.bUseB;
+		W.freeze(param.W, format, mem);
+		if (bUseB) {
+			b.freeze(param.b, format, mem);
+		}
+	}
+
+	inline size_t bytes() const {
+		return W.bytes() + b.bytes();
+	}
+
+	//reads a file of UniParams::save
+	inline void loadTrained(std::ifstream &is, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W.loadParam(is, format, mem);
+		if (bUseB) {
+			b.loadParam(is, format, mem);
+		}
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << bUseB << std::endl;
+		W.save(os);
+		if (bUseB) {
+			b.save(os);
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W.load(is, mem);
+		if (bUseB) {
+			b.load(is, mem);
+		}
+	}
+};
+
+struct HalfBiParams {
+public:
+	HalfParam W1;
+	HalfParam W2;
+	HalfParam b;
+	bool bUseB;
+
+public:
+	HalfBiParams() {
+		bUseB = true;
+	}
+
+	inline void freeze(const BiParams& param, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		bUseB = param.bUseB;
+		W1.freeze(param.W1, format, mem);
+		W2.freeze(param.W2, format, mem);
+		if (bUseB) {
+			b.freeze(param.b, format, mem);
+		}
+	}
+
+	inline size_t bytes() const {
+		return W1.bytes() + W2.bytes() + b.bytes();
+	}
+
+	//reads a file of BiParams::save
+	inline void loadTrained(std::ifstream &is, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W1.loadParam(is, format, mem);
+		W2.loadParam(is, format, mem);
+		if (bUseB) {
+			b.loadParam(is, format, mem);
+		}
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << bUseB << std::endl;
+		W1.save(os);
+		W2.save(os);
+		if (bUseB) {
+			b.save(os);
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W1.load(is, mem);
+		W2.load(is, mem);
+		if (bUseB) {
+			b.load(is, mem);
+		}
+	}
+};
+
+struct HalfTriParams {
+public:
+	HalfParam W1;
+	HalfParam W2;
+	HalfParam W3;
+	HalfParam b;
+	bool bUseB;
+
+public:
+	HalfTriParams() {
+		bUseB = true;
+	}
+
+	inline void freeze(const TriParams& param, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		bUseB = param.bUseB;
+		W1.freeze(param.W1, format, mem);
+		W2.freeze(param.W2, format, mem);
+		W3.freeze(param.W3, format, mem);
+		if (bUseB) {
+			b.freeze(param.b, format, mem);
+		}
+	}
+
+	inline size_t bytes() const {
+		return W1.bytes() + W2.bytes() + W3.bytes() + b.bytes();
+	}
+
+	//reads a file of TriParams::save
+	inline void loadTrained(std::ifstream &is, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W1.loadParam(is, format, mem);
+		W2.loadParam(is, format, mem);
+		W3.loadParam(is, format, mem);
+		if (bUseB) {
+			b.loadParam(is, format, mem);
+		}
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << bUseB << std::endl;
+		W1.save(os);
+		W2.save(os);
+		W3.save(os);
+		if (bUseB) {
+			b.save(os);
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W1.load(is, mem);
+		W2.load(is, mem);
+		W3.load(is, mem);
+		if (bUseB) {
+			b.load(is, mem);
+		}
+	}
+};
+
+struct HalfLookupTable {
+public:
+	PAlphabet elems;
+	HalfParam E;
+	int nDim;
+	int nVSize;
+	int nUNKId;
+
+public:
+	HalfLookupTable() {
+		nVSize = 0;
+		nDim = 0;
+		elems = NULL;
+		nUNKId = -1;
+	}
+
+	inline void freeze(const LookupTable& table, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		elems = table.elems;
+		nDim = table.nDim;
+		nVSize = table.nVSize;
+		nUNKId = table.nUNKId;
+		E.freeze(table.E, format, mem);
+	}
+
+	inline size_t bytes() const {
+		return E.bytes();
+	}
+
+	inline int getElemId(const string& strFeat) const {
+		return elems->from_string(strFeat);
+	}
+
+	//reads a file of LookupTable::save, set alpha directly
+	inline void loadTrained(std::ifstream &is, PAlphabet alpha, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		bool bFineTune;
+		E.loadSparseParam(is, format, mem);
+		is >> bFineTune;
+		is >> nDim;
+		is >> nVSize;
+		is >> nUNKId;
+		elems = alpha;
+	}
+
+	inline void save(std::ofstream &os) const {
+		E.save(os);
+		os << nDim << std::endl;
+		os << nVSize << std::endl;
+		os << nUNKId << std::endl;
+	}
+
+	//set alpha directly
+	inline void load(std::ifstream &is, PAlphabet alpha, AlignedMemoryPool* mem = NULL) {
+		E.load(is, mem);
+		is >> nDim;
+		is >> nVSize;
+		is >> nUNKId;
+		elems = alpha;
+	}
+};
+
+
+struct HalfUniNode : Node {
+public:
+	PNode in;
+	Tensor1D ty;
+	HalfUniParams* param;
+
+	dtype (*activate)(const dtype&);   // activation function
+
+public:
+	HalfUniNode() : Node() {
+		in = NULL;
+		activate = ftanh;
+		param = NULL;
+	}
+
+	inline void setParam(HalfUniParams* paramInit) {
+		param = paramInit;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&)) {
+		activate = f;
+	}
+
+	inline double flops() const {
+		return 2.0 * param->W.inDim() * dim;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		in = NULL;
+		ty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes();
+	}
+
+public:
+	void forward(Graph *cg, PNode x) {
+		in = x;
+		cg->require(in);
+		in->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.zero();
+		param->W.multiply(in->val, ty);
+		if (param->bUseB) {
+			param->b.add(0, 1, ty);
+		}
+		activate_forward(activate, ty, val);
+	}
+};
+
+struct HalfBiNode : Node {
+public:
+	PNode in1, in2;
+	Tensor1D ty;
+	HalfBiParams* param;
+
+	dtype (*activate)(const dtype&);   // activation function
+
+public:
+	HalfBiNode() : Node() {
+		in1 = in2 = NULL;
+		activate = ftanh;
+		param = NULL;
+	}
+
+	inline void setParam(HalfBiParams* paramInit) {
+		param = paramInit;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&)) {
+		activate = f;
+	}
+
+	inline double flops() const {
+		return 2.0 * (param->W1.inDim() + param->W2.inDim()) * dim;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		in1 = in2 = NULL;
+		ty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes();
+	}
+
+public:
+	void forward(Graph *cg, PNode x1, PNode x2) {
+		in1 = x1;
+		in2 = x2;
+		cg->require(in1);
+		cg->require(in2);
+		in1->increase_loc();
+		in2->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.zero();
+		param->W1.multiply(in1->val, ty);
+		param->W2.multiply(in2->val, ty);
+		if (param->bUseB) {
+			param->b.add(0, 1, ty);
+		}
+		activate_forward(activate, ty, val);
+	}
+};
+
+struct HalfTriNode : Node {
+public:
+	PNode in1, in2, in3;
+	Tensor1D ty;
+	HalfTriParams* param;
+
+	dtype (*activate)(const dtype&);   // activation function
+
+public:
+	HalfTriNode() : Node() {
+		in1 = in2 = in3 = NULL;
+		activate = ftanh;
+		param = NULL;
+	}
+
+	inline void setParam(HalfTriParams* paramInit) {
+		param = paramInit;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&)) {
+		activate = f;
+	}
+
+	inline double flops() const {
+		return 2.0 * (param->W1.inDim() + param->W2.inDim() + param->W3.inDim()) * dim;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		in1 = in2 = in3 = NULL;
+		ty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes();
+	}
+
+public:
+	void forward(Graph *cg, PNode x1, PNode x2, PNode x3) {
+		in1 = x1;
+		in2 = x2;
+		in3 = x3;
+		cg->require(in1);
+		cg->require(in2);
+		cg->require(in3);
+		in1->increase_loc();
+		in2->increase_loc();
+		in3->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.zero();
+		param->W1.multiply(in1->val, ty);
+		param->W2.multiply(in2->val, ty);
+		param->W3.multiply(in3->val, ty);
+		if (param->bUseB) {
+			param->b.add(0, 1, ty);
+		}
+		activate_forward(activate, ty, val);
+	}
+};
+
+struct HalfLookupNode : Node {
+public:
+	HalfLookupTable* param;
+	int xid;
+
+public:
+	HalfLookupNode() {
+		xid = -1;
+		param = NULL;
+	}
+
+	inline void setParam(HalfLookupTable* paramInit) {
+		param = paramInit;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		xid = -1;
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+public:
+	//this should be leaf nodes
+	void forward(Graph *cg, const string& strNorm) {
+		assert(param != NULL);
+		xid = param->getElemId(strNorm);
+		if (xid < 0 && param->nUNKId >= 0){
+			xid = param->nUNKId;
+		}
+		if (xid >= 0){
+			param->E.value(xid, val);
+		}
+		else{
+			val.zero();
+		}
+
+		cg->addNode(this);
+	}
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef N3L_HALFPARAM_H
+#define N3L_HALFPARAM_H
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <Eigen/Core>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+#include "MyTensor.h"
+#include "BaseParam.h"
+
+// 16-bit storage of frozen weights, for inference only.
+// bf16 keeps the range of float with 8 bits of mantissa, fp16 keeps 11 bits in a smaller range.
+enum HalfFormat {
+	HALF_BF16 = 0,
+	HALF_FP16 = 1
+};
+
+typedef unsigned short half_t;
+
+inline half_t half_from(float x, HalfFormat format) {
+	if (format == HALF_FP16) {
+		return Eigen::half(x).x;
+	}
+	unsigned int bits;
+	memcpy(&bits, &x, sizeof(bits));
+	if ((bits & 0x7fffffff) > 0x7f800000) return (half_t)((bits >> 16) | 0x40);  // nan stays nan
+	bits += 0x7fff + ((bits >> 16) & 1);  // round to nearest even
+	return (half_t)(bits >> 16);
+}
+
+inline float half_to(half_t h, HalfFormat format) {
+	if (format == HALF_FP16) {
+		return Eigen::half_impl::half_to_float(Eigen::half_impl::raw_uint16_to_half(h));
+	}
+	unsigned int bits = (unsigned int)h << 16;
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+// n values of src to float
+inline void half_expand(const half_t* src, float* dst, int n, HalfFormat format) {
+	int idx = 0;
+	if (format == HALF_FP16) {
+#if defined(__F16C__)
+		for (; idx + 8 <= n; idx += 8) {
+			_mm256_storeu_ps(dst + idx, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + idx))));
+		}
+#endif
+		for (; idx < n; idx++) dst[idx] = half_to(src[idx], format);
+		return;
+	}
+	for (; idx < n; idx++) {
+		unsigned int bits = (unsigned int)src[idx] << 16;
+		memcpy(dst + idx, &bits, sizeof(float));
+	}
+}
+
+// the frozen value of a Param or SparseParam, without gradient and optimizer states.
+// the layout is that of val (row = output dim, one column per input or per embedding),
+// and the kernels convert the columns they read into float on the fly,
+// so memory and bandwidth of the weights are a half of float and a quarter of double.
+struct HalfParam {
+public:
+	Tensor2DT<half_t> val;
+	HalfFormat format;
+
+public:
+	HalfParam() {
+		format = HALF_BF16;
+	}
+
+	inline int outDim() const {
+		return val.row;
+	}
+
+	inline int inDim() const {
+		return val.col;
+	}
+
+	inline size_t bytes() const {
+		return val.bytes();
+	}
+
+	inline void freeze(const BaseParam& param, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		this->format = format;
+		val.init(param.val.row, param.val.col, mem);
+		for (int idx = 0; idx < val.size; idx++) {
+			val.v[idx] = half_from(param.val.v[idx], format);
+		}
+	}
+
+	//y += W x
+	inline void multiply(const Tensor1D& x, Tensor1D& y) const {
+		for (int idx = 0; idx < val.col; idx++) {
+			if (x[idx] != 0) add(idx, x[idx], y);
+		}
+	}
+
+	//y += scale * the column id
+	inline void add(int id, dtype scale, Tensor1D& y) const {
+		const int block = 64;
+		float column[block];
+		const half_t* cur = val[id];
+		for (int start = 0; start < val.row; start += block) {
+			int n = std::min(block, val.row - start);
+			half_expand(cur + start, column, n, format);
+			for (int idy = 0; idy < n; idy++) {
+				y[start + idy] += scale * column[idy];
+			}
+		}
+	}
+
+	//the column id, e.g., the embedding of a word
+	inline void value(int id, Tensor1D& out) const {
+		if (out.dim != val.row) {
+			std::cout << "warning: output dim not equal half param dim." << std::endl;
+		}
+		out.zero();
+		add(id, 1, out);
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << format << std::endl;
+		val.save(os);
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		int curFormat;
+		is >> curFormat;
+		format = (HalfFormat)curFormat;
+		val.load(is, mem);
+	}
+
+	//reads the value of a tensor saved by Tensor2D::save
+	inline void loadValue(std::ifstream &is, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		this->format = format;
+		int curSize, curRow, curCol;
+		is >> curSize >> curRow >> curCol;
+		val.init(curRow, curCol, mem);
+		double cur;
+		for (int idx = 0; idx < val.size; idx++) {
+			is >> cur;
+			val.v[idx] = half_from(cur, format);
+		}
+	}
+
+	//passes a tensor saved by Tensor2D::save without keeping it, e.g., the optimizer states
+	static inline void skipTensor(std::ifstream &is) {
+		int curSize, curRow, curCol;
+		is >> curSize >> curRow >> curCol;
+		double cur;
+		for (int idx = 0; idx < curSize; idx++) {
+			is >> cur;
+		}
+	}
+
+	//reads a file of Param::save
+	inline void loadParam(std::ifstream &is, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		loadValue(is, format, mem);
+		skipTensor(is);
+		skipTensor(is);
+		int iter;
+		is >> iter;
+	}
+
+	//reads a file of SparseParam::save
+	inline void loadSparseParam(std::ifstream &is, HalfFormat format, AlignedMemoryPool* mem = NULL) {
+		loadValue(is, format, mem);
+		skipTensor(is);
+		skipTensor(is);
+		int curInDim, last;
+		is >> curInDim;
+		for (int idx = 0; idx < curInDim; idx++) {
+			is >> last;
+		}
+	}
+};
+
+#endif
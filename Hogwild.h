@@ -0,0 +1,108 @@
+#ifndef N3L_HOGWILD_H
+#define N3L_HOGWILD_H
+
+#include <atomic>
+#include "ModelUpdate.h"
+#include "ThreadPool.h"
+
+// lock-free asynchronous training over threads (hogwild)
+// every worker owns a replica of the model as in DataParallelTrainer,
+// but the replica params share both the values and the optimizer states of the master.
+// a worker updates the shared params right after each example with its own gradients,
+// there is no reduction and no barrier between examples.
+// it suits sparse params (LookupTable, SparseParams, SparseC*Params),
+// whose updates only touch the rows in their private indexers.
+class HogwildTrainer {
+public:
+	ModelUpdate* _master;
+	vector<ModelUpdate*> _replicas;
+	vector<dtype> _costs;
+	ThreadPool* _pool;
+
+public:
+	HogwildTrainer() {
+		_master = NULL;
+		_replicas.clear();
+		_pool = NULL;
+	}
+
+	~HogwildTrainer() {
+		clear();
+	}
+
+	inline void clear() {
+		if (_pool) delete _pool;
+		_pool = NULL;
+		_master = NULL;
+		_replicas.clear();
+		_costs.clear();
+	}
+
+public:
+	inline bool init(ModelUpdate* master, const vector<ModelUpdate*>& replicas) {
+		clear();
+		int paramNum = master->_params.size();
+		for (int idx = 0; idx < replicas.size(); idx++) {
+			if (replicas[idx]->_params.size() != paramNum) {
+				std::cout << "hogwild error: replica " << idx << " has a different number of params" << std::endl;
+				return false;
+			}
+			for (int idy = 0; idy < paramNum; idy++) {
+				BaseParam* param = master->_params[idy];
+				BaseParam* replica = replicas[idx]->_params[idy];
+				if (param->val.row != replica->val.row || param->val.col != replica->val.col) {
+					std::cout << "hogwild error: param " << idy << " of replica " << idx << " does not match" << std::endl;
+					return false;
+				}
+			}
+		}
+
+		_master = master;
+		_replicas = replicas;
+		for (int idx = 0; idx < _replicas.size(); idx++) {
+			ModelUpdate* replica = _replicas[idx];
+			for (int idy = 0; idy < paramNum; idy++) {
+				replica->_params[idy]->shareState(_master->_params[idy]);
+			}
+			replica->_reg = _master->_reg;
+			replica->_alpha = _master->_alpha;
+			replica->_eps = _master->_eps;
+			replica->_belta1 = _master->_belta1;
+			replica->_belta2 = _master->_belta2;
+		}
+		_costs.resize(_replicas.size());
+		_pool = new ThreadPool(_replicas.size());
+		return true;
+	}
+
+	inline int workers() const {
+		return _replicas.size();
+	}
+
+	// func(worker, index) runs forward and backward of example index on the replica of worker,
+	// and returns its cost. the replica then applies adam with gradient clipping by maxScale.
+	// examples are taken by whichever worker is free, returns the summed cost.
+	template<typename Func>
+	inline dtype train(int count, Func func, dtype maxScale = -1) {
+		std::atomic<int> next(0);
+		_pool->run([&](int worker) {
+			ModelUpdate* replica = _replicas[worker];
+			dtype cost = 0.0;
+			int idx;
+			while ((idx = next++) < count) {
+				cost += func(worker, idx);
+				replica->updateAdam(maxScale);
+			}
+			_costs[worker] = cost;
+		});
+
+		dtype cost = 0.0;
+		for (int idx = 0; idx < _replicas.size(); idx++) {
+			cost += _costs[idx];
+		}
+		return cost;
+	}
+
+};
+
+#endif
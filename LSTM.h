@@ -7,6 +7,7 @@
 #include "BiOP.h"
 #include "AtomicOP.h"
 #include "Graph.h"
+#include "SeqProj.h"
 
 struct LSTMParams {
 	TriParams input;
@@ -49,27 +50,33 @@ public:
 	int _inDim;
 	int _outDim;
 
-	vector<TriNode> _inputgates;
-	vector<TriNode> _forgetgates;
-	vector<BiNode> _halfcells;
+	vector<SeqStepNode> _inputgates;
+	vector<SeqStepNode> _forgetgates;
+	vector<SeqStepNode> _halfcells;
 
 	vector<PMultNode> _inputfilters;
 	vector<PMultNode> _forgetfilters;
 
 	vector<PAddNode> _cells;
 
-	vector<TriNode> _outputgates;
+	vector<SeqStepNode> _outputgates;
 
 	vector<TanhNode> _halfhiddens;
 
 	vector<PMultNode> _hiddens;
 
+	SeqProjNode _inputproj, _forgetproj, _outputproj, _cellproj;  //the x terms of all the steps, before them
+
 	Node _bucket;
 
 	LSTMParams* _param;
 
 	bool _left2right;
 
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+	dtype _dropout;
+
 public:
 	LSTMBuilder(){
 		clear();
@@ -87,18 +94,36 @@ public:
 		
 		int maxsize = _inputgates.size();
 		for (int idx = 0; idx < maxsize; idx++){
-			_inputgates[idx].setParam(&_param->input);
-			_forgetgates[idx].setParam(&_param->forget);
-			_outputgates[idx].setParam(&_param->output);
-			_halfcells[idx].setParam(&_param->cell);
+			setParam(_inputgates[idx], _param->input);
+			setParam(_forgetgates[idx], _param->forget);
+			setParam(_outputgates[idx], _param->output);
+			_halfcells[idx].setParam(&_param->cell.W1, NULL, _param->cell.bUseB ? &_param->cell.b : NULL);
 			_inputgates[idx].setFunctions(&fsigmoid, &dsigmoid);
 			_forgetgates[idx].setFunctions(&fsigmoid, &dsigmoid);
 			_outputgates[idx].setFunctions(&fsigmoid, &dsigmoid);
 			_halfcells[idx].setFunctions(&ftanh, &dtanh);
 		}
+		_inputproj.init(&_param->input.W3, 0, _inDim, maxsize, mem);
+		_forgetproj.init(&_param->forget.W3, 0, _inDim, maxsize, mem);
+		_outputproj.init(&_param->output.W3, 0, _inDim, maxsize, mem);
+		_cellproj.init(&_param->cell.W2, 0, _inDim, maxsize, mem);
 		_left2right = left2right;
-		
-		for (int idx = 0; idx < maxsize; idx++){
+
+		_capacity = 0;
+		_mem = mem;
+		_dropout = dropout;
+		_bucket.init(_outDim, -1, mem);
+		_bucket.set_bucket();
+	}
+
+	//the gate without its x term W3 x
+	inline void setParam(SeqStepNode& gate, TriParams& param) {
+		gate.setParam(&param.W1, &param.W2, param.bUseB ? &param.b : NULL);
+	}
+
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		if (!reserveNodes("lstm", size, _inputgates.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
 			_inputgates[idx].init(_outDim, -1, mem);
 			_forgetgates[idx].init(_outDim, -1, mem);
 			_halfcells[idx].init(_outDim, -1, mem);
@@ -107,11 +132,21 @@ public:
 			_cells[idx].init(_outDim, -1, mem);
 			_outputgates[idx].init(_outDim, -1, mem);
 			_halfhiddens[idx].init(_outDim, -1, mem);
-			_hiddens[idx].init(_outDim, dropout, mem);			
-		}
-				
-		_bucket.init(_outDim, -1, mem);
-		_bucket.set_bucket();
+			_hiddens[idx].init(_outDim, _dropout, mem);
+		})) return false;
+		_inputproj.reserve(_capacity);
+		_forgetproj.reserve(_capacity);
+		_outputproj.reserve(_capacity);
+		_cellproj.reserve(_capacity);
+		return true;
+	}
+
+	inline size_t bytes() const {
+		return nodeBytes(_inputgates) + nodeBytes(_forgetgates) + nodeBytes(_halfcells)
+			+ nodeBytes(_inputfilters) + nodeBytes(_forgetfilters) + nodeBytes(_cells)
+			+ nodeBytes(_outputgates) + nodeBytes(_halfhiddens) + nodeBytes(_hiddens)
+			+ _inputproj.bytes() + _forgetproj.bytes() + _outputproj.bytes() + _cellproj.bytes()
+			+ _bucket.bytes();
 	}
 
 	inline void resize(int maxsize){
@@ -142,6 +177,9 @@ public:
 		_nSize = 0;
 		_inDim = 0;
 		_outDim = 0;
+		_capacity = 0;
+		_mem = NULL;
+		_dropout = -1;
 	}
 
 public:
@@ -156,7 +194,12 @@ public:
 			std::cout << "input dim does not match for seg operation" << std::endl;
 			return;
 		}
+		if (!reserve(_nSize)) return;
 
+		_inputproj.forward(cg, x);
+		_forgetproj.forward(cg, x);
+		_outputproj.forward(cg, x);
+		_cellproj.forward(cg, x);
 		if (_left2right){
 			left2right_forward(cg, x);
 		}
@@ -171,9 +214,9 @@ protected:
 	inline void left2right_forward(Graph *cg, const vector<PNode>& x){
 		for (int idx = 0; idx < _nSize; idx++){
 			if (idx == 0){
-				_inputgates[idx].forward(cg, &_bucket, &_bucket, x[idx]);
+				_inputgates[idx].forward(cg, &_bucket, &_bucket, &_inputproj, idx);
 
-				_halfcells[idx].forward(cg, &_bucket, x[idx]);
+				_halfcells[idx].forward(cg, &_bucket, NULL, &_cellproj, idx);
 
 				_inputfilters[idx].forward(cg, &_halfcells[idx], &_inputgates[idx]);
 
@@ -181,16 +224,16 @@ protected:
 
 				_halfhiddens[idx].forward(cg, &_cells[idx]);
 
-				_outputgates[idx].forward(cg, &_bucket, &_cells[idx], x[idx]);
+				_outputgates[idx].forward(cg, &_bucket, &_cells[idx], &_outputproj, idx);
 
 				_hiddens[idx].forward(cg, &_halfhiddens[idx], &_outputgates[idx]);
 			}
 			else{
-				_inputgates[idx].forward(cg, &_hiddens[idx - 1], &_cells[idx - 1], x[idx]);
+				_inputgates[idx].forward(cg, &_hiddens[idx - 1], &_cells[idx - 1], &_inputproj, idx);
 
-				_forgetgates[idx].forward(cg, &_hiddens[idx - 1], &_cells[idx - 1], x[idx]);
+				_forgetgates[idx].forward(cg, &_hiddens[idx - 1], &_cells[idx - 1], &_forgetproj, idx);
 
-				_halfcells[idx].forward(cg, &_hiddens[idx - 1], x[idx]);
+				_halfcells[idx].forward(cg, &_hiddens[idx - 1], NULL, &_cellproj, idx);
 
 				_inputfilters[idx].forward(cg, &_halfcells[idx], &_inputgates[idx]);
 
@@ -200,7 +243,7 @@ protected:
 
 				_halfhiddens[idx].forward(cg, &_cells[idx]);
 
-				_outputgates[idx].forward(cg, &_hiddens[idx - 1], &_cells[idx], x[idx]);
+				_outputgates[idx].forward(cg, &_hiddens[idx - 1], &_cells[idx], &_outputproj, idx);
 
 				_hiddens[idx].forward(cg, &_halfhiddens[idx], &_outputgates[idx]);
 			}
@@ -210,9 +253,9 @@ protected:
 	inline void right2left_forward(Graph *cg, const vector<PNode>& x){
 		for (int idx = _nSize - 1; idx >= 0; idx--){
 			if (idx == _nSize - 1){
-				_inputgates[idx].forward(cg, &_bucket, &_bucket, x[idx]);
+				_inputgates[idx].forward(cg, &_bucket, &_bucket, &_inputproj, idx);
 
-				_halfcells[idx].forward(cg, &_bucket, x[idx]);
+				_halfcells[idx].forward(cg, &_bucket, NULL, &_cellproj, idx);
 
 				_inputfilters[idx].forward(cg, &_halfcells[idx], &_inputgates[idx]);
 
@@ -220,16 +263,16 @@ protected:
 
 				_halfhiddens[idx].forward(cg, &_cells[idx]);
 
-				_outputgates[idx].forward(cg, &_bucket, &_cells[idx], x[idx]);
+				_outputgates[idx].forward(cg, &_bucket, &_cells[idx], &_outputproj, idx);
 
 				_hiddens[idx].forward(cg, &_halfhiddens[idx], &_outputgates[idx]);
 			}
 			else{
-				_inputgates[idx].forward(cg, &_hiddens[idx + 1], &_cells[idx + 1], x[idx]);
+				_inputgates[idx].forward(cg, &_hiddens[idx + 1], &_cells[idx + 1], &_inputproj, idx);
 
-				_forgetgates[idx].forward(cg, &_hiddens[idx + 1], &_cells[idx + 1], x[idx]);
+				_forgetgates[idx].forward(cg, &_hiddens[idx + 1], &_cells[idx + 1], &_forgetproj, idx);
 
-				_halfcells[idx].forward(cg, &_hiddens[idx + 1], x[idx]);
+				_halfcells[idx].forward(cg, &_hiddens[idx + 1], NULL, &_cellproj, idx);
 
 				_inputfilters[idx].forward(cg, &_halfcells[idx], &_inputgates[idx]);
 
@@ -239,7 +282,7 @@ protected:
 
 				_halfhiddens[idx].forward(cg, &_cells[idx]);
 
-				_outputgates[idx].forward(cg, &_hiddens[idx + 1], &_cells[idx], x[idx]);
+				_outputgates[idx].forward(cg, &_hiddens[idx + 1], &_cells[idx], &_outputproj, idx);
 
 				_hiddens[idx].forward(cg, &_halfhiddens[idx], &_outputgates[idx]);
 			}
@@ -318,6 +361,12 @@ public:
 		_bucket.set_bucket();
 	}
 
+	inline size_t bytes() const {
+		return _inputgate.bytes() + _forgetgate.bytes() + _halfcell.bytes() + _inputfilter.bytes()
+			+ _forgetfilter.bytes() + _cell.bytes() + _outputgate.bytes() + _halfhidden.bytes()
+			+ _hidden.bytes() + _bucket.bytes();
+	}
+
 
 public:
 	inline void forward(Graph *cg, PNode x, IncLSTMBuilder* prev = NULL){
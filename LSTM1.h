@@ -84,6 +84,10 @@ public:
 
     bool _left2right;
 
+    int _capacity;  //nodes with their tensors allocated
+    AlignedMemoryPool* _mem;
+    dtype _dropout;
+
 public:
     LSTM1Builder() {
         clear();
@@ -111,7 +115,16 @@ public:
         }
         _left2right = left2right;
 
-        for (int idx = 0; idx < maxsize; idx++) {
+        _capacity = 0;
+        _mem = mem;
+        _dropout = dropout;
+        _bucket.init(_outDim, -1, mem);
+        _bucket.set_bucket();
+    }
+
+    // the tensors of the nodes are allocated on demand, see reserveNodes
+    inline bool reserve(int size) {
+        return reserveNodes("lstm", size, _inputgates.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
             _inputgates[idx].init(_outDim, -1, mem);
             _forgetgates[idx].init(_outDim, -1, mem);
             _halfcells[idx].init(_outDim, -1, mem);
@@ -120,10 +133,15 @@ public:
             _cells[idx].init(_outDim, -1, mem);
             _outputgates[idx].init(_outDim, -1, mem);
             _halfhiddens[idx].init(_outDim, -1, mem);
-            _hiddens[idx].init(_outDim, dropout, mem);
-        }
-        _bucket.init(_outDim, -1, mem);
-        _bucket.set_bucket();
+            _hiddens[idx].init(_outDim, _dropout, mem);
+        });
+    }
+
+    inline size_t bytes() const {
+        return nodeBytes(_inputgates) + nodeBytes(_forgetgates) + nodeBytes(_halfcells)
+            + nodeBytes(_inputfilters) + nodeBytes(_forgetfilters) + nodeBytes(_cells)
+            + nodeBytes(_outputgates) + nodeBytes(_halfhiddens) + nodeBytes(_hiddens)
+            + _bucket.bytes();
     }
 
     inline void resize(int maxsize) {
@@ -155,6 +173,9 @@ public:
         _nSize = 0;
         _inDim = 0;
         _outDim = 0;
+        _capacity = 0;
+        _mem = NULL;
+        _dropout = -1;
     }
 
 public:
@@ -169,6 +190,7 @@ public:
             std::cout << "input dim does not match for seg operation" << std::endl;
             return;
         }
+        if (!reserve(_nSize)) return;
 
         if (_left2right) {
             left2right_forward(cg, x);
@@ -333,6 +355,12 @@ public:
         _bucket.set_bucket();
     }
 
+    inline size_t bytes() const {
+        return _inputgate.bytes() + _forgetgate.bytes() + _halfcell.bytes() + _inputfilter.bytes()
+            + _forgetfilter.bytes() + _cell.bytes() + _outputgate.bytes() + _halfhidden.bytes()
+            + _hidden.bytes() + _bucket.bytes();
+    }
+
 
 public:
     inline void forward(Graph *cg, PNode x, IncLSTM1Builder* prev = NULL) {
@@ -0,0 +1,369 @@
+#ifndef LSTMBATCH_H_
+#define LSTMBATCH_H_
+
+#include "MyLib.h"
+#include "Node.h"
+#include "Param.h"
+#include "SeqProj.h"
+#include "LSTMCell.h"
+#include "Graph.h"
+
+// one timestep of a packed batch of sentences, sorted by length so that the active ones are the first batch columns.
+// the gates are G = W[:, :H] [h_0 ... h_B-1] + P + b, i.e., one H x B GEMM instead of B GEMVs, and the backward likewise.
+// val is the H x B hiddens by columns, the cells are kept inside the node.
+struct LSTMBatchNode : Node {
+public:
+    LSTMBatchNode* prev;  //NULL for the first step, with no fewer columns
+    SeqProjNode* proj;
+    int offset, batch;  //the first column of proj, and the active columns
+    Tensor2D gates;  //input, forget, cell, output after activation, 4H x B
+    Tensor2D cell, tcell;  //tcell = tanh(cell)
+    Tensor2D lgates, lcell;  //lcell is added to by the next step
+
+    LSTMCellParams* param;
+    int hDim, maxbatch;
+
+public:
+    LSTMBatchNode() : Node() {
+        prev = NULL;
+        proj = NULL;
+        offset = batch = 0;
+        param = NULL;
+        hDim = maxbatch = 0;
+    }
+
+    inline void setParam(LSTMCellParams* paramInit) {
+        param = paramInit;
+    }
+
+    inline double flops() const {
+        return 8.0 * hDim * hDim * batch;
+    }
+
+    inline const void* paramKey() const {
+        return param;
+    }
+
+    inline void clearValue() {
+        Node::clearValue();
+        prev = NULL;
+        proj = NULL;
+        batch = 0;
+        lcell.zero();
+    }
+
+    //setParam first
+    inline void init(int hDim, int maxbatch, dtype dropOut, AlignedMemoryPool* mem = NULL) {
+        this->hDim = hDim;
+        this->maxbatch = maxbatch;
+        Node::init(hDim * maxbatch, dropOut, mem);
+        gates.init(4 * hDim, maxbatch, mem);
+        cell.init(hDim, maxbatch, mem);
+        tcell.init(hDim, maxbatch, mem);
+        if (inference) return;
+        lgates.init(4 * hDim, maxbatch, mem);
+        lcell.init(hDim, maxbatch, mem);
+    }
+
+    inline size_t bytes() const {
+        return Node::bytes() + gates.bytes() + cell.bytes() + tcell.bytes() + lgates.bytes() + lcell.bytes();
+    }
+
+public:
+    void forward(Graph *cg, LSTMBatchNode* last, SeqProjNode* p, int offset, int batch) {
+        if (batch > maxbatch || (last && last->batch < batch)) {
+            std::cout << "lstm batch error: " << batch << " columns do not fit the step" << std::endl;
+            return;
+        }
+        prev = last;
+        proj = p;
+        this->offset = offset;
+        this->batch = batch;
+        if (prev) {
+            cg->require(prev);
+            prev->increase_loc();
+        }
+        cg->require(proj);
+        proj->increase_loc();
+
+        compute();
+        cg->addNode(this);
+    }
+
+    inline void compute() {
+        int H = hDim, n = batch;
+        MatT<dtype> G(gates.v, 4 * H, n);
+        if (prev) {
+            G.noalias() = param->W.val.mat().leftCols(H) * MatT<dtype>(prev->val.v, H, n);
+            G += MatT<dtype>(proj->column(offset), 4 * H, n);
+        }
+        else {
+            G = MatT<dtype>(proj->column(offset), 4 * H, n);
+        }
+        G.colwise() += param->b.val.mat().col(0);
+
+        for (int idx = 0; idx < n; idx++) {
+            dtype* col = gates.v + idx * 4 * H;
+            VecT<dtype> sigmoids(col, 2 * H), g(col + 2 * H, H), o(col + 3 * H, H);
+            activate_forward(fsigmoid, sigmoids, sigmoids);
+            activate_forward(ftanh, g, g);
+            activate_forward(fsigmoid, o, o);
+
+            VecT<dtype> i(col, H), f(col + H, H), c(cell.v + idx * H, H);
+            if (prev) c = i * g + f * VecT<dtype>(prev->cell.v + idx * H, H);
+            else c = i * g;
+        }
+        activate_forward(ftanh, VecT<dtype>(cell.v, H * n), VecT<dtype>(tcell.v, H * n));
+        for (int idx = 0; idx < n; idx++) {
+            VecT<dtype>(val.v + idx * H, H) = VecT<dtype>(tcell.v + idx * H, H) * VecT<dtype>(gates.v + idx * 4 * H + 3 * H, H);
+        }
+    }
+
+    void backward() {
+        int H = hDim, n = batch;
+        for (int idx = 0; idx < n; idx++) {
+            dtype* col = gates.v + idx * 4 * H;
+            dtype* lcol = lgates.v + idx * 4 * H;
+            VecT<dtype> i(col, H), f(col + H, H), g(col + 2 * H, H), o(col + 3 * H, H);
+            VecT<dtype> li(lcol, H), lf(lcol + H, H), lg(lcol + 2 * H, H), lo(lcol + 3 * H, H);
+            VecT<dtype> l(loss.v + idx * H, H), t(tcell.v + idx * H, H), lc(lcell.v + idx * H, H);
+
+            lo = l * t * (o.constant(1) - o) * o;
+            lc += l * o * (t.constant(1) + t) * (t.constant(1) - t);
+            li = lc * g * (i.constant(1) - i) * i;
+            lg = lc * i * (g.constant(1) + g) * (g.constant(1) - g);
+            if (prev) {
+                lf = lc * VecT<dtype>(prev->cell.v + idx * H, H) * (f.constant(1) - f) * f;
+                VecT<dtype>(prev->lcell.v + idx * H, H) += lc * f;
+            }
+            else {
+                lf.setZero();
+            }
+        }
+
+        MatT<dtype> LG(lgates.v, 4 * H, n);
+        param->b.grad.mat().col(0) += LG.rowwise().sum();
+        MatT<dtype>(proj->lossColumn(offset), 4 * H, n) += LG;
+        if (!prev) return;
+        param->W.grad.mat().leftCols(H).noalias() += LG * MatT<dtype>(prev->val.v, H, n).transpose();
+        MatT<dtype>(prev->loss.v, H, n).noalias() += param->W.val.mat().leftCols(H).transpose() * LG;
+    }
+
+    inline void unlock() {
+        if (prev) prev->decrease_loc();
+        proj->decrease_loc();
+        if (!lossed) return;
+        if (prev) prev->lossed = true;
+        proj->lossed = true;
+    }
+};
+
+// column col of a batched node, e.g., the hidden of one sentence at one step of LSTMBatchNode
+struct BatchColumnNode : Node {
+public:
+    PNode in;
+    int col;
+
+public:
+    BatchColumnNode() : Node() {
+        in = NULL;
+        col = 0;
+    }
+
+    inline void clearValue() {
+        Node::clearValue();
+        in = NULL;
+    }
+
+    inline bool overwrites() const {
+        return true;
+    }
+
+public:
+    void forward(Graph *cg, PNode x, int col) {
+        in = x;
+        this->col = col;
+        cg->require(in);
+        in->increase_loc();
+
+        compute();
+        cg->addNode(this);
+    }
+
+    inline void compute() {
+        val.vec() = VecT<dtype>(in->val.v + col * dim, dim);
+    }
+
+    void backward() {
+        VecT<dtype>(in->loss.v + col * dim, dim) += loss.vec();
+    }
+
+    inline void unlock() {
+        in->decrease_loc();
+        if (!lossed) return;
+        in->lossed = true;
+    }
+};
+
+// LSTMCellBuilder over a batch of sentences of different lengths, packed as in packed sequences:
+// the sentences are sorted by length, the input projections of all their words are one GEMM,
+// and step t runs the sentences longer than t as one LSTMBatchNode, so the batch shrinks as they finish.
+// the hidden of word j of sentence b is _hiddens[b][j], as _hiddens[j] of LSTMCellBuilder on that sentence.
+class PackedLSTMCellBuilder {
+public:
+    int _nBatch;
+    int _nSize;  //the longest
+    int _inDim;
+    int _outDim;
+
+    vector<LSTMBatchNode> _steps;
+    vector<vector<BatchColumnNode> > _hiddens;
+    SeqProjNode _proj;
+
+    LSTMCellParams* _param;
+
+    bool _left2right;
+
+    int _capacity;  //steps with their tensors allocated
+    AlignedMemoryPool* _mem;
+    dtype _dropout;
+
+protected:
+    vector<int> _order;  //sentences by decreasing length
+    vector<PNode> _packed;  //words by step, then by _order
+
+public:
+    PackedLSTMCellBuilder() {
+        clear();
+    }
+
+    ~PackedLSTMCellBuilder() {
+        clear();
+    }
+
+public:
+    //maxbatch sentences of at most maxsize words
+    inline void resize(int maxsize, int maxbatch) {
+        _steps.resize(maxsize);
+        _hiddens.resize(maxbatch);
+        for (int idx = 0; idx < maxbatch; idx++) {
+            _hiddens[idx].resize(maxsize);
+        }
+    }
+
+    inline void init(LSTMCellParams* paramInit, dtype dropout, bool left2right = true, AlignedMemoryPool* mem = NULL) {
+        _param = paramInit;
+        _inDim = _param->inDim();
+        _outDim = _param->outDim();
+        int maxsize = _steps.size();
+        for (int idx = 0; idx < maxsize; idx++) {
+            _steps[idx].setParam(_param);
+        }
+        _left2right = left2right;
+        _proj.init(&_param->W, _outDim, _inDim, maxsize * _hiddens.size(), mem);
+
+        _capacity = 0;
+        _mem = mem;
+        _dropout = dropout;
+    }
+
+    // the tensors of the nodes are allocated on demand, see reserveNodes
+    inline bool reserve(int size) {
+        int maxbatch = _hiddens.size();
+        return reserveNodes("packed lstm", size, _steps.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
+            _steps[idx].init(_outDim, maxbatch, _dropout, mem);
+            for (int idy = 0; idy < maxbatch; idy++) {
+                _hiddens[idy][idx].init(_outDim, -1, mem);
+            }
+        });
+    }
+
+    inline size_t bytes() const {
+        size_t total = nodeBytes(_steps) + _proj.bytes();
+        for (int idx = 0; idx < _hiddens.size(); idx++) {
+            total += nodeBytes(_hiddens[idx]);
+        }
+        return total;
+    }
+
+    inline void clear() {
+        _steps.clear();
+        _hiddens.clear();
+        _order.clear();
+        _packed.clear();
+
+        _left2right = true;
+        _param = NULL;
+        _nBatch = 0;
+        _nSize = 0;
+        _inDim = 0;
+        _outDim = 0;
+        _capacity = 0;
+        _mem = NULL;
+        _dropout = -1;
+    }
+
+public:
+    inline void forward(Graph *cg, const vector<vector<PNode> >& x) {
+        _nBatch = x.size();
+        if (_nBatch == 0) {
+            std::cout << "empty inputs for packed lstm operation" << std::endl;
+            return;
+        }
+        if (_nBatch > _hiddens.size()) {
+            std::cout << "packed lstm error: " << _nBatch << " sentences exceed the batch of " << _hiddens.size() << ", resize first" << std::endl;
+            return;
+        }
+        _order.resize(_nBatch);
+        for (int idx = 0; idx < _nBatch; idx++) {
+            _order[idx] = idx;
+            if (x[idx].size() > 0 && x[idx][0]->val.dim != _inDim) {
+                std::cout << "input dim does not match for packed lstm operation" << std::endl;
+                return;
+            }
+        }
+        std::stable_sort(_order.begin(), _order.end(), LongerFirst(x));
+        _nSize = x[_order[0]].size();
+        if (_nSize == 0) {
+            std::cout << "empty inputs for packed lstm operation" << std::endl;
+            return;
+        }
+        if (!reserve(_nSize)) return;
+
+        _packed.clear();
+        for (int step = 0; step < _nSize; step++) {
+            for (int idx = 0; idx < _nBatch && x[_order[idx]].size() > step; idx++) {
+                _packed.push_back(x[_order[idx]][word(x[_order[idx]].size(), step)]);
+            }
+        }
+        _proj.forward(cg, _packed);
+
+        int offset = 0;
+        for (int step = 0; step < _nSize; step++) {
+            int batch = 0;
+            while (batch < _nBatch && x[_order[batch]].size() > step) batch++;
+            _steps[step].forward(cg, step == 0 ? NULL : &_steps[step - 1], &_proj, offset, batch);
+            for (int idx = 0; idx < batch; idx++) {
+                int sent = _order[idx];
+                _hiddens[sent][word(x[sent].size(), step)].forward(cg, &_steps[step], idx);
+            }
+            offset += batch;
+        }
+    }
+
+protected:
+    //the word of a sentence of size words read at step
+    inline int word(int size, int step) const {
+        return _left2right ? step : size - 1 - step;
+    }
+
+    struct LongerFirst {
+        const vector<vector<PNode> >& x;
+        LongerFirst(const vector<vector<PNode> >& sents) : x(sents) {}
+        inline bool operator()(int a, int b) const {
+            return x[a].size() > x[b].size();
+        }
+    };
+};
+
+#endif
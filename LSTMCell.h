@@ -0,0 +1,374 @@
+#ifndef LSTMCELL_H_
+#define LSTMCELL_H_
+
+#include "MyLib.h"
+#include "Node.h"
+#include "Param.h"
+#include "LSTM1.h"
+#include "SeqProj.h"
+#include "Graph.h"
+
+// the params of LSTM1Params stacked into one matrix, W = [W1 W2] of the gates input, forget, cell and output by rows,
+// i.e., 4H x (H + I), and one bias of 4H. the files are those of LSTM1Params, both in load and save,
+// so models of LSTM1Builder run by LSTMCellBuilder and back, with their optimizer states.
+struct LSTMCellParams {
+    Param W;
+    Param b;
+    int nOSize, nISize;
+
+    LSTMCellParams() {
+        nOSize = nISize = 0;
+    }
+
+    inline void exportAdaParams(ModelUpdate& ada) {
+        ada.addParam(&W);
+        ada.addParam(&b);
+    }
+
+    //drawn as LSTM1Params::initial
+    inline void initial(int nOSize, int nISize, AlignedMemoryPool* mem = NULL) {
+        LSTM1Params param;
+        param.initial(nOSize, nISize);
+        pack(param, mem);
+    }
+
+    inline int inDim() {
+        return nISize;
+    }
+
+    inline int outDim() {
+        return nOSize;
+    }
+
+    //the values and optimizer states of param, which stays unchanged
+    inline void pack(LSTM1Params& param, AlignedMemoryPool* mem = NULL) {
+        nOSize = param.outDim();
+        nISize = param.inDim();
+        W.initial(4 * nOSize, nOSize + nISize, mem);
+        b.initial(4 * nOSize, 1, mem);
+        BiParams* gates[4] = { &param.input, &param.forget, &param.cell, &param.output };
+        for (int idx = 0; idx < 4; idx++) {
+            int row = idx * nOSize;
+            packBlock(W, gates[idx]->W1, row, 0);
+            packBlock(W, gates[idx]->W2, row, nOSize);
+            packBlock(b, gates[idx]->b, row, 0);
+        }
+        W.iter = b.iter = param.input.W1.iter;
+    }
+
+    inline void save(std::ofstream &os) const {
+        int order[4] = { 0, 3, 1, 2 };  //input, output, forget, cell as LSTM1Params::save
+        for (int idx = 0; idx < 4; idx++) {
+            int row = order[idx] * nOSize;
+            os << true << std::endl;
+            saveBlock(os, W, row, 0, nOSize, nOSize);
+            saveBlock(os, W, row, nOSize, nOSize, nISize);
+            saveBlock(os, b, row, 0, nOSize, 1);
+        }
+    }
+
+    inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+        LSTM1Params param;
+        param.load(is);
+        pack(param, mem);
+    }
+
+protected:
+    static inline void packBlock(Param& dst, const Param& src, int row, int col) {
+        dst.val.mat().block(row, col, src.val.row, src.val.col) = src.val.mat();
+        dst.aux_square.mat().block(row, col, src.val.row, src.val.col) = src.aux_square.mat();
+        dst.aux_mean.mat().block(row, col, src.val.row, src.val.col) = src.aux_mean.mat();
+    }
+
+    static inline void saveBlock(std::ofstream &os, const Param& src, int row, int col, int rows, int cols) {
+        Tensor2D block;
+        block.init(rows, cols);
+        block.mat() = src.val.mat().block(row, col, rows, cols);
+        block.save(os);
+        block.mat() = src.aux_square.mat().block(row, col, rows, cols);
+        block.save(os);
+        block.mat() = src.aux_mean.mat().block(row, col, rows, cols);
+        block.save(os);
+        os << src.iter << std::endl;
+    }
+};
+
+// one step of LSTM1Builder fused in one node: the four gates by one GEMV of the stacked W,
+// then the nonlinearities and the cell in one pass, and the backward likewise.
+// val is the hidden, the cell is kept inside the node, and the previous step is the only recurrent input.
+// given a SeqProjNode of W[:, H:], the step takes its column in place of the product with x, and multiplies the hidden only.
+struct LSTMCellNode : Node {
+public:
+    LSTMCellNode* prev;  //NULL for the first step
+    PNode in;  //x, or the projection
+    SeqProjNode* proj;
+    int step;
+    Tensor1D hx;  //[hidden of prev; x]
+    Tensor1D gates;  //input, forget, cell, output after activation
+    Tensor1D cell, tcell;  //tcell = tanh(cell)
+    Tensor1D lgates, lcell, lhx;  //losses, lcell is added to by the next step
+
+    LSTMCellParams* param;
+    int inDim;
+
+public:
+    LSTMCellNode() : Node() {
+        prev = NULL;
+        in = NULL;
+        proj = NULL;
+        step = 0;
+        param = NULL;
+        inDim = 0;
+    }
+
+    inline void setParam(LSTMCellParams* paramInit) {
+        param = paramInit;
+        inDim = param->nISize;
+    }
+
+    inline double flops() const {
+        return proj ? 8.0 * dim * dim : 8.0 * dim * (dim + inDim);
+    }
+
+    inline const void* paramKey() const {
+        return param;
+    }
+
+    inline void clearValue() {
+        Node::clearValue();
+        prev = NULL;
+        in = NULL;
+        proj = NULL;
+        lcell.zero();
+    }
+
+    //setParam first
+    inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL) {
+        Node::init(dim, dropOut, mem);
+        hx.init(dim + inDim, mem);
+        gates.init(4 * dim, mem);
+        cell.init(dim, mem);
+        tcell.init(dim, mem);
+        if (inference) return;
+        lgates.init(4 * dim, mem);
+        lcell.init(dim, mem);
+        lhx.init(dim + inDim, mem);
+    }
+
+    inline size_t bytes() const {
+        return Node::bytes() + hx.bytes() + gates.bytes() + cell.bytes() + tcell.bytes()
+            + lgates.bytes() + lcell.bytes() + lhx.bytes();
+    }
+
+public:
+    void forward(Graph *cg, LSTMCellNode* last, PNode x) {
+        prev = last;
+        in = x;
+        proj = NULL;
+        if (prev) {
+            cg->require(prev);
+            prev->increase_loc();
+        }
+        cg->require(in);
+        in->increase_loc();
+
+        compute();
+        cg->addNode(this);
+    }
+
+    //the input side is column t of p, which is run before
+    void forward(Graph *cg, LSTMCellNode* last, SeqProjNode* p, int t) {
+        link(last, p, t);
+        acquire(cg);
+        compute();
+        cg->addNode(this);
+    }
+
+    //the inputs only, compute and acquire are left to the caller, see BiCell.h
+    inline void link(LSTMCellNode* last, SeqProjNode* p, int t) {
+        prev = last;
+        in = p;
+        proj = p;
+        step = t;
+    }
+
+    inline void acquire(Graph *cg) {
+        if (prev) {
+            cg->require(prev);
+            prev->increase_loc();
+        }
+        cg->require(in);
+        in->increase_loc();
+    }
+
+    inline void compute() {
+        VecT<dtype> h(hx.v, dim), x(hx.v + dim, inDim);
+        if (prev) h = prev->val.vec();
+        else h.setZero();
+
+        if (proj) {
+            gates.mat().noalias() = param->W.val.mat().leftCols(dim) * MatT<dtype>(hx.v, dim, 1);
+            gates.vec() += VecT<dtype>(proj->column(step), 4 * dim);
+        }
+        else {
+            x = in->val.vec();
+            gates.mat().noalias() = param->W.val.mat() * hx.mat();
+        }
+        gates.vec() += param->b.val.vec();
+
+        VecT<dtype> sigmoids(gates.v, 2 * dim), g(gates.v + 2 * dim, dim), o(gates.v + 3 * dim, dim);
+        activate_forward(fsigmoid, sigmoids, sigmoids);
+        activate_forward(ftanh, g, g);
+        activate_forward(fsigmoid, o, o);
+
+        VecT<dtype> i(gates.v, dim), f(gates.v + dim, dim);
+        if (prev) cell.vec() = i * g + f * prev->cell.vec();
+        else cell.vec() = i * g;
+        activate_forward(ftanh, cell, tcell);
+        val.vec() = tcell.vec() * o;
+    }
+
+    void backward() {
+        VecT<dtype> i(gates.v, dim), f(gates.v + dim, dim), g(gates.v + 2 * dim, dim), o(gates.v + 3 * dim, dim);
+        VecT<dtype> li(lgates.v, dim), lf(lgates.v + dim, dim), lg(lgates.v + 2 * dim, dim), lo(lgates.v + 3 * dim, dim);
+
+        lo = loss.vec() * tcell.vec() * (o.constant(1) - o) * o;
+        lcell.vec() += loss.vec() * o * (tcell.vec().constant(1) + tcell.vec()) * (tcell.vec().constant(1) - tcell.vec());
+        li = lcell.vec() * g * (i.constant(1) - i) * i;
+        lg = lcell.vec() * i * (g.constant(1) + g) * (g.constant(1) - g);
+        if (prev) {
+            lf = lcell.vec() * prev->cell.vec() * (f.constant(1) - f) * f;
+            prev->lcell.vec() += lcell.vec() * f;
+        }
+        else {
+            lf.setZero();
+        }
+
+        param->b.grad.vec() += lgates.vec();
+        if (proj) {
+            VecT<dtype>(proj->lossColumn(step), 4 * dim) += lgates.vec();
+            if (!prev) return;
+            param->W.grad.mat().leftCols(dim).noalias() += lgates.mat() * MatT<dtype>(hx.v, dim, 1).transpose();
+            MatT<dtype>(lhx.v, dim, 1).noalias() = param->W.val.mat().leftCols(dim).transpose() * lgates.mat();
+            prev->loss.vec() += VecT<dtype>(lhx.v, dim);
+            return;
+        }
+
+        param->W.grad.mat().noalias() += lgates.mat() * hx.tmat();
+        lhx.mat().noalias() = param->W.val.mat().transpose() * lgates.mat();
+        if (prev) prev->loss.vec() += VecT<dtype>(lhx.v, dim);
+        in->loss.vec() += VecT<dtype>(lhx.v + dim, inDim);
+    }
+
+    inline void unlock() {
+        if (prev) prev->decrease_loc();
+        in->decrease_loc();
+        if (!lossed) return;
+        if (prev) prev->lossed = true;
+        in->lossed = true;
+    }
+};
+
+// LSTM1Builder by fused steps, the hiddens are in _hiddens as before
+class LSTMCellBuilder {
+public:
+    int _nSize;
+    int _inDim;
+    int _outDim;
+
+    vector<LSTMCellNode> _hiddens;
+    SeqProjNode _proj;  //W[:, H:] of all the inputs, before the steps
+
+    LSTMCellParams* _param;
+
+    bool _left2right;
+
+    int _capacity;  //nodes with their tensors allocated
+    AlignedMemoryPool* _mem;
+    dtype _dropout;
+
+public:
+    LSTMCellBuilder() {
+        clear();
+    }
+
+    ~LSTMCellBuilder() {
+        clear();
+    }
+
+public:
+    inline void init(LSTMCellParams* paramInit, dtype dropout, bool left2right = true, AlignedMemoryPool* mem = NULL) {
+        _param = paramInit;
+        _inDim = _param->inDim();
+        _outDim = _param->outDim();
+        int maxsize = _hiddens.size();
+        for (int idx = 0; idx < maxsize; idx++) {
+            _hiddens[idx].setParam(_param);
+        }
+        _left2right = left2right;
+        _proj.init(&_param->W, _outDim, _inDim, maxsize, mem);
+
+        _capacity = 0;
+        _mem = mem;
+        _dropout = dropout;
+    }
+
+    // the tensors of the nodes are allocated on demand, see reserveNodes
+    inline bool reserve(int size) {
+        if (!reserveNodes("lstm cell", size, _hiddens.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
+            _hiddens[idx].init(_outDim, _dropout, mem);
+        })) return false;
+        _proj.reserve(_capacity);
+        return true;
+    }
+
+    inline size_t bytes() const {
+        return nodeBytes(_hiddens) + _proj.bytes();
+    }
+
+    inline void resize(int maxsize) {
+        _hiddens.resize(maxsize);
+    }
+
+    inline void clear() {
+        _hiddens.clear();
+
+        _left2right = true;
+        _param = NULL;
+        _nSize = 0;
+        _inDim = 0;
+        _outDim = 0;
+        _capacity = 0;
+        _mem = NULL;
+        _dropout = -1;
+    }
+
+public:
+    inline void forward(Graph *cg, const vector<PNode>& x) {
+        if (x.size() == 0) {
+            std::cout << "empty inputs for lstm operation" << std::endl;
+            return;
+        }
+
+        _nSize = x.size();
+        if (x[0]->val.dim != _inDim) {
+            std::cout << "input dim does not match for seg operation" << std::endl;
+            return;
+        }
+        if (!reserve(_nSize)) return;
+
+        _proj.forward(cg, x);
+        if (_left2right) {
+            for (int idx = 0; idx < _nSize; idx++) {
+                _hiddens[idx].forward(cg, idx == 0 ? NULL : &_hiddens[idx - 1], &_proj, idx);
+            }
+        }
+        else {
+            for (int idx = _nSize - 1; idx >= 0; idx--) {
+                _hiddens[idx].forward(cg, idx == _nSize - 1 ? NULL : &_hiddens[idx + 1], &_proj, idx);
+            }
+        }
+    }
+};
+
+#endif
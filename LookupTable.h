@@ -197,11 +197,19 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		xid = -1;
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 public:
 	//notice the output
 	//this should be leaf nodes
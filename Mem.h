@@ -5,9 +5,14 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
 #if !_WINDOWS
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#else
+#include <windows.h>
 #endif
 
 #include <fcntl.h>
@@ -15,58 +20,198 @@
 #include <mm_malloc.h>
 #endif
 //This is the code copied from dynet: only CPU model
+//the chunks are reserved as virtual memory, pages are committed (and zeroed) by the system on first touch,
+//or on windows by the pool as the allocations advance (see commit), so an unused part of the pool costs
+//neither time nor resident memory.
+//the pool grows by chunks when full, instead of leaving the tensors to the heap.
+//to size a pool exactly, run the init calls once against a counting pool, see measure():
+//	size_t bytes = AlignedMemoryPool::measure([&](AlignedMemoryPool* mem){ builder.resize(max_length); builder.init(&params, dropout, mem); builder.reserve(max_length); });
+//	AlignedMemoryPool pool(1, bytes);
+//	builder.init(&params, dropout, &pool);
+//	builder.reserve(max_length);
+//without reserve, the builders take the tensors of their nodes on demand, and the pool grows as needed.
+//a pool is not thread-safe: on demand, the nodes grow in the pool given by growth(), see reserveNodes in Node.h.
+//a pool may prefer the memory of one numa node, and a thread may set its own pool as local(),
+//which the tensors of nodes take when they are given no pool, see Numa.h.
 
 class AlignedMemoryPool {
 private:
 	const static int align = 32;
-	const static size_t unit_size = 1 << 30;
+	const static size_t default_unit_size = 1 << 30;
+	const static size_t commit_step = 1 << 20;  //bytes committed at once on windows
 private:
-	char** mem;
+	std::vector<char*> mem;
+	std::vector<size_t> sizes;  //bytes of each chunk
+	std::vector<size_t> commits;  //bytes committed of each chunk, windows only
+	std::vector<size_t> ends;  //bytes given out of each chunk, zeroed by zero_allocated_memory
+	size_t unit_size;
+	bool hugepages;
+	int numa;  //the numa node preferred by the chunks, -1 for none
+	std::vector<char*> sinks;  //of a counting pool, the older ones are kept for the tensors still pointing to them
+	size_t sink_size;
 public:
-	size_t capacity;
-	size_t used, index;
-	float required;  // orcale required size
+	size_t capacity;  //chunks reserved
+	size_t used, index;  //the current chunk and the offset in it
+	float required;  // orcale required size, in units
+	size_t requested;  // bytes allocated so far, aligned
+	size_t fallbacks, fallback_bytes;  // tensors left to new[] as the pool failed, counted by the tensors
+	bool counting;  // only counts: every allocation shares one sink, nothing is reserved
+	bool fixed;  // holds nothing: the tensors fall back to new[], see heap()
+	std::thread::id owner;  // the thread creating the pool
 private:
 	inline std::size_t round_up_align(std::size_t n) const {
 		if (align < 2) return n;
 		return ((n + align - 1) / align) * align;
 	}
 
-	void malloc(std::size_t n) {
-		capacity = n;
-		mem = new char*[capacity];
-		for (int idx = 0; idx < capacity; idx++) {
-			mem[idx] = (char*)_mm_malloc(unit_size, align);
-			if (!mem[idx]) {
-				std::cerr << "CPU memory allocation failed capacity=" << idx << " align=" << align << std::endl;
-			}
-			zero((void*)(mem[idx]), unit_size);
+	//reserves one more chunk of at least n bytes, returns false if the system refuses
+	bool reserve(std::size_t n) {
+		size_t size = n > unit_size ? n : unit_size;
+		char* chunk = NULL;
+#if !_WINDOWS
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p != MAP_FAILED) {
+			chunk = (char*)p;
+#ifdef MADV_HUGEPAGE
+			if (hugepages) madvise(p, size, MADV_HUGEPAGE);
+#endif
+			if (numa >= 0) prefer(p, size);
+		}
+#else
+		chunk = (char*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);
+#endif
+		if (!chunk) {
+			std::cerr << "CPU memory allocation failed capacity=" << capacity << " size=" << size << std::endl;
+			return false;
+		}
+		mem.push_back(chunk);
+		sizes.push_back(size);
+		commits.push_back(0);
+		ends.push_back(0);
+		capacity = mem.size();
+		return true;
+	}
+
+	//makes the first n bytes of the chunk usable, the system does it on first touch but on windows
+	bool commit(size_t chunk, std::size_t n) {
+#if _WINDOWS
+		if (n <= commits[chunk]) return true;
+		size_t target = ((n + commit_step - 1) / commit_step) * commit_step;
+		if (target > sizes[chunk]) target = sizes[chunk];
+		if (!VirtualAlloc(mem[chunk] + commits[chunk], target - commits[chunk], MEM_COMMIT, PAGE_READWRITE)) {
+			std::cerr << "CPU memory commit failed chunk=" << chunk << " size=" << target << std::endl;
+			return false;
+		}
+		commits[chunk] = target;
+#endif
+		return true;
+	}
+
+	//pages are placed on the numa node when first touched, by whichever thread
+	void prefer(void* p, std::size_t n) {
+#if !_WINDOWS && defined(SYS_mbind)
+		const int preferred = 1;  //MPOL_PREFERRED
+		unsigned long mask[16] = { 0 };
+		if (numa >= 16 * 8 * sizeof(unsigned long)) return;
+		mask[numa / (8 * sizeof(unsigned long))] = 1UL << (numa % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, p, n, preferred, mask, 16 * 8 * sizeof(unsigned long), 0) != 0) {
+			std::cerr << "memory pool warning: can not prefer numa node " << numa << std::endl;
 		}
+#endif
 	}
 
 	void free() {
-		for (int idx = 0; idx < capacity; idx++) {
-			_mm_free((void*)mem[idx]);
+		for (int idx = 0; idx < mem.size(); idx++) {
+#if !_WINDOWS
+			munmap((void*)mem[idx], sizes[idx]);
+#else
+			VirtualFree((void*)mem[idx], 0, MEM_RELEASE);
+#endif
+		}
+		mem.clear();
+		sizes.clear();
+		commits.clear();
+		ends.clear();
+		for (int idx = 0; idx < sinks.size(); idx++) {
+			_mm_free(sinks[idx]);
+		}
+		sinks.clear();
+		sink_size = 0;
+	}
+
+	//the dry run writes its tensors (e.g., zero in init), they all land in the sink
+	void* sink(std::size_t n) {
+		if (n > sink_size) {
+			sinks.push_back((char*)_mm_malloc(n, align));
+			sink_size = n;
 		}
-		delete[] mem;
-		mem = NULL;
+		return sinks.back();
 	}
 
 public:
-	AlignedMemoryPool(size_t cap) {
+	// cap chunks of unit bytes are reserved at first, hugepages asks for transparent huge pages,
+	// node is the numa node to prefer, -1 for the default policy (first touch)
+	AlignedMemoryPool(size_t cap, size_t unit = default_unit_size, bool huge = false, int node = -1) {
 		used = 0;
 		index = 0;
-		capacity = cap;
-		if (capacity > 0) {
-			malloc(capacity);
+		capacity = 0;
+		unit_size = round_up_align(unit);
+		hugepages = huge;
+		numa = node;
+		sink_size = 0;
+		counting = false;
+		fixed = false;
+		owner = std::this_thread::get_id();
+		for (size_t idx = 0; idx < cap; idx++) {
+			if (!reserve(unit_size)) break;
 		}
 		required = 0;
+		requested = 0;
+		fallbacks = 0;
+		fallback_bytes = 0;
+	}
+
+	// the pool of this thread, taken by the tensors of nodes initialized without a pool, NULL by default
+	static inline AlignedMemoryPool*& local() {
+		static thread_local AlignedMemoryPool* pool = NULL;
+		return pool;
+	}
+
+	// the pool of no memory, whose tensors are freed by their release, e.g., of the nodes growing again
+	static inline AlignedMemoryPool* heap() {
+		struct Heap : AlignedMemoryPool {
+			Heap() : AlignedMemoryPool(0) {
+				fixed = true;
+			}
+		};
+		static Heap pool;
+		return &pool;
+	}
+
+	// the pool to take tensors from in forward, which may run on any thread, e.g., the replicas of
+	// DataParallel sharing mem: mem if this thread created it, else the pool of this thread, else the heap
+	static inline AlignedMemoryPool* growth(AlignedMemoryPool* mem) {
+		if (mem != NULL && mem->owner == std::this_thread::get_id()) return mem;
+		if (local() != NULL) return local();
+		return heap();
+	}
+
+	inline int node() const {
+		return numa;
+	}
+
+	// bytes allocated by init(mem), which is called with a counting pool.
+	// the tensors initialized there point to garbage afterwards, init them again with the real pool.
+	template<typename Init>
+	static size_t measure(Init init) {
+		AlignedMemoryPool counter(0);
+		counter.counting = true;
+		init(&counter);
+		return counter.requested;
 	}
 
 	~AlignedMemoryPool() {
-		if (capacity > 0) {
-			free();
-		}
+		free();
 		capacity = 0;
 		used = 0;
 		index = 0;
@@ -79,38 +224,67 @@ public:
 
 	void* allocate(size_t n, size_t& aligned) {
 		aligned = round_up_align(n);
+		if (fixed) return NULL;
 		required += aligned * 1.0 / unit_size; //never mind if the memory is allocated successfully.
-		if (used == capacity || aligned > unit_size) {
-			//std::cout << "allocated size bigger than unit size!" << std::endl;
-			return NULL;
-		}
-		void* res = NULL;
-		if (aligned + index <= unit_size) {
-			//std::cout << "aligned memory is full: " << capacity << ")\n";
-			res = mem[used] + index;
-			index += aligned;
-			if (index == unit_size) {
-				used++;
-				index = 0;
-			}
-		}
-		else if (used + 1 < capacity) {
-			used++;
-			index = 0;
-			res = mem[used] + index;
+		requested += aligned;
+		if (counting) return sink(aligned);
+		if (used < capacity && aligned + index <= sizes[used]) {
+			if (!commit(used, index + aligned)) return NULL;
+			void* res = mem[used] + index;
 			index += aligned;
+			ends[used] = index;
+			return res;
 		}
 
-		return res;
+		//the rest of the current chunk is skipped, take the next one or grow
+		size_t next = (used < capacity && index == 0) ? used : used + 1;
+		while (next < capacity && sizes[next] < aligned) next++;
+		if (next >= capacity) {
+			if (!reserve(aligned)) return NULL;
+			next = capacity - 1;
+			std::cout << "memory pool grows to " << capacity << " chunks, " << reserved() << " bytes reserved" << std::endl;
+		}
+		if (!commit(next, aligned)) return NULL;
+		used = next;
+		index = aligned;
+		ends[used] = index;
+		return mem[used];
 	}
 
-	// zeros out the amount of allocations
+	// zeros out the amount of allocations, not the skipped tails of the chunks, which stay untouched
 	void zero_allocated_memory() {
-		if (used == 0 && index == 0) return;
-		for (int idx = 0; idx < used; idx++) {
-			zero((void*)(mem[idx]), unit_size);
+		for (int idx = 0; idx <= used && idx < capacity; idx++) {
+			zero((void*)(mem[idx]), ends[idx]);
+		}
+	}
+
+	// bytes given to the tensors
+	inline size_t allocated() const {
+		return requested;
+	}
+
+	// high-water mark of the chunks, the skipped tails of the full chunks included
+	inline size_t peak() const {
+		if (capacity == 0) return 0;
+		size_t total = 0;
+		for (int idx = 0; idx < used && idx < capacity; idx++) {
+			total += sizes[idx];
+		}
+		return used < capacity ? total + index : total;
+	}
+
+	inline void fallback(size_t n) {
+		if (fixed) return;
+		fallbacks++;
+		fallback_bytes += n;
+	}
+
+	inline size_t reserved() const {
+		size_t total = 0;
+		for (int idx = 0; idx < sizes.size(); idx++) {
+			total += sizes[idx];
 		}
-		zero((void*)(mem[used]), unit_size);
+		return total;
 	}
 
 };
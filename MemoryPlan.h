@@ -0,0 +1,212 @@
+#ifndef N3L_MEMORYPLAN_H
+#define N3L_MEMORYPLAN_H
+
+#include <map>
+#include <algorithm>
+#include "Node.h"
+
+// liveness-based sharing of node values in forward-only (inference) graphs.
+// only val is shared: the other buffers of a node, e.g., ty of the ops or expv of SoftmaxNode, keep their own memory.
+// like register allocation, values whose lifetimes do not overlap share the slices of one slab,
+// so the working set is the peak of the live values instead of all the values.
+// the value of a node lives from its computation to the addNode of its last consumer,
+// leaf nodes (without inputs) from the beginning, as their values are set before forward,
+// and nodes without consumers, i.e., the outputs, to the end.
+// other values are zeroed once dead, so a node always starts from a zeroed value.
+template<typename T>
+struct MemoryPlanT {
+	typedef NodeT<T>* PNode;
+
+	vector<PNode> execs;
+	vector<vector<PNode> > inputs;  //inputs of each exec in the order read, recorded by input_tracker
+	vector<int> firsts, lasts;  //lifetimes in exec positions
+	vector<size_t> offsets;  //in scalars
+	vector<int> sizes;  //dims of the values at build, the lengths of their slices
+	vector<vector<int> > deaths;  //values dead after each exec
+	vector<T*> origins;  //own memory of the values
+	Tensor1DT<T> slab;
+	bool complete;
+
+	MemoryPlanT(){
+		complete = false;
+	}
+
+public:
+	inline void record(PNode x, vector<PNode>& reads){
+		execs.push_back(x);
+		inputs.push_back(reads);
+		reads.clear();
+	}
+
+	inline void reset(){
+		execs.clear();
+		inputs.clear();
+		firsts.clear();
+		lasts.clear();
+		offsets.clear();
+		sizes.clear();
+		deaths.clear();
+		origins.clear();
+		complete = false;
+	}
+
+	// computes the lifetimes and assigns the slices first-fit, in the order of their first uses
+	inline void build(AlignedMemoryPool* mem){
+		int count = execs.size();
+		map<PNode, int> positions;
+		for (int idx = 0; idx < count; idx++){
+			positions[execs[idx]] = idx;
+		}
+		firsts.resize(count);
+		lasts.assign(count, -1);
+		for (int idx = 0; idx < count; idx++){
+			firsts[idx] = inputs[idx].empty() ? 0 : idx;
+			for (int idy = 0; idy < inputs[idx].size(); idy++){
+				typename map<PNode, int>::iterator it = positions.find(inputs[idx][idy]);
+				if (it != positions.end() && it->second < idx){
+					lasts[it->second] = idx;
+				}
+			}
+		}
+		deaths.assign(count, vector<int>());
+		for (int idx = 0; idx < count; idx++){
+			if (lasts[idx] < 0){
+				lasts[idx] = count;
+			}
+			else{
+				deaths[lasts[idx]].push_back(idx);
+			}
+		}
+
+		vector<int> order(count);
+		for (int idx = 0; idx < count; idx++) order[idx] = idx;
+		stable_sort(order.begin(), order.end(), [this](int a, int b){ return firsts[a] < firsts[b]; });
+
+		sizes.resize(count);
+		for (int idx = 0; idx < count; idx++){
+			sizes[idx] = execs[idx]->val.dim;
+		}
+		const size_t unit = 32 / sizeof(T) > 0 ? 32 / sizeof(T) : 1;
+		vector<int> active;  //sorted by offset
+		size_t total = 0;
+		offsets.resize(count);
+		for (int idx = 0; idx < count; idx++){
+			int cur = order[idx];
+			size_t size = slice(cur, unit);
+			vector<int> alive;
+			for (int idy = 0; idy < active.size(); idy++){
+				if (lasts[active[idy]] >= firsts[cur]) alive.push_back(active[idy]);
+			}
+			active.swap(alive);
+
+			size_t offset = 0;
+			int pos = 0;
+			for (; pos < active.size(); pos++){
+				int other = active[pos];
+				if (offset + size <= offsets[other]) break;
+				offset = std::max(offset, offsets[other] + slice(other, unit));
+			}
+			offsets[cur] = offset;
+			active.insert(active.begin() + pos, cur);
+			total = std::max(total, offset + size);
+		}
+
+		if (slab.dim < total){
+			slab.release();
+			slab.init(total, mem);
+		}
+		origins.resize(count);
+		complete = true;
+	}
+
+	inline size_t slice(int idx, size_t unit) const {
+		return (sizes[idx] + unit - 1) / unit * unit;
+	}
+
+	//whether the values have the dims they were planned for, e.g., not grown by a longer example since
+	inline bool fits() const {
+		for (int idx = 0; idx < execs.size(); idx++){
+			if (execs[idx]->val.dim != sizes[idx]) return false;
+		}
+		return true;
+	}
+
+	//whether execs[pos] still computes in its slice
+	inline bool fits(int pos) const {
+		return execs[pos]->val.dim == sizes[pos] && execs[pos]->val.v == slab.v + offsets[pos];
+	}
+
+	//the plan must fit, or be recorded again
+	inline void bind(){
+		int count = execs.size();
+		for (int idx = 0; idx < count; idx++){
+			origins[idx] = execs[idx]->val.v;
+			execs[idx]->val.v = slab.v + offsets[idx];
+		}
+	}
+
+	inline void unbind(){
+		int count = execs.size();
+		for (int idx = 0; idx < count; idx++){
+			if (execs[idx]->val.v == slab.v + offsets[idx]) execs[idx]->val.v = origins[idx];
+		}
+	}
+
+	//after the addNode of execs[pos]
+	inline void release(int pos){
+		for (int idx = 0; idx < deaths[pos].size(); idx++){
+			int dead = deaths[pos][idx];
+			memset((void*)execs[dead]->val.v, 0, sizes[dead] * sizeof(T));
+		}
+	}
+
+	//whether the node at pos reads what execs[pos] did so far, checked at each read before it is computed
+	inline bool expects(int pos, const vector<PNode>& reads) const {
+		if (pos >= execs.size() || reads.size() > inputs[pos].size()) return false;
+		return reads.empty() || inputs[pos][reads.size() - 1] == reads.back();
+	}
+
+	//whether the value of x has been zeroed, or reused, before pos
+	inline bool released(int pos, PNode x) const {
+		for (int idx = 0; idx < pos && idx < execs.size(); idx++){
+			if (execs[idx] == x) return lasts[idx] < pos;
+		}
+		return false;
+	}
+
+	// the graph differs from the plan at pos by x (NULL if found before x is added), the live values go back to their own memory.
+	// a value out of its slice has been allocated again, e.g., by a node grown in forward, and is left there
+	inline void abandon(int pos, PNode x){
+		int count = execs.size();
+		for (int idx = 0; idx < count; idx++){
+			bool live = (idx < pos) ? lasts[idx] >= pos : (firsts[idx] == 0 || execs[idx] == x);
+			T* v = execs[idx]->val.v;
+			if (v != slab.v + offsets[idx]) continue;
+			execs[idx]->val.v = origins[idx];
+			if (live){
+				memcpy(origins[idx], v, sizes[idx] * sizeof(T));
+			}
+			else{
+				execs[idx]->val.zero();
+			}
+		}
+		reset();
+	}
+
+	//bytes of the slab against those of the values
+	inline size_t planned() const {
+		return slab.bytes();
+	}
+
+	inline size_t unplanned() const {
+		size_t total = 0;
+		for (int idx = 0; idx < execs.size(); idx++){
+			total += execs[idx]->val.bytes();
+		}
+		return total;
+	}
+};
+
+typedef MemoryPlanT<dtype> MemoryPlan;
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef N3L_MEMORYSTATS_H
+#define N3L_MEMORYSTATS_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <functional>
+#include "Mem.h"
+#include "BaseParam.h"
+#include "ModelUpdate.h"
+
+// memory of a model: the pools, the params and the builders registered by name.
+// the numbers are read when asked, so one registry can be dumped at any time, e.g., after each epoch.
+//	MemoryStats stats;
+//	stats.addPool("nodes", &pool);
+//	stats.addParams("model", ada);
+//	stats.addBuilder("left_lstm", &left_lstm);
+//	stats.dump(std::cout);
+class MemoryStats {
+protected:
+	vector<pair<string, const AlignedMemoryPool*> > pools;
+	vector<pair<string, const BaseParam*> > params;
+	vector<pair<string, std::function<size_t()> > > builders;
+
+public:
+	inline void clear(){
+		pools.clear();
+		params.clear();
+		builders.clear();
+	}
+
+	inline void addPool(const string& name, const AlignedMemoryPool* pool){
+		pools.push_back(make_pair(name, pool));
+	}
+
+	inline void addParam(const string& name, const BaseParam* param){
+		params.push_back(make_pair(name, param));
+	}
+
+	//the params of ada, named by prefix and their order
+	inline void addParams(const string& prefix, const ModelUpdate& ada){
+		for (int idx = 0; idx < ada._params.size(); idx++){
+			std::stringstream ss;
+			ss << prefix << "." << idx;
+			addParam(ss.str(), ada._params[idx]);
+		}
+	}
+
+	//any builder with bytes(), e.g., LSTM1Builder, GatedPoolBuilder
+	template<typename Builder>
+	inline void addBuilder(const string& name, const Builder* builder){
+		builders.push_back(make_pair(name, std::function<size_t()>([builder]() { return builder->bytes(); })));
+	}
+
+public:
+	inline size_t poolBytes() const {
+		size_t total = 0;
+		for (int idx = 0; idx < pools.size(); idx++){
+			total += pools[idx].second->reserved();
+		}
+		return total;
+	}
+
+	inline ParamBytes paramBytes() const {
+		ParamBytes total;
+		total.value = total.gradient = total.optimizer = 0;
+		for (int idx = 0; idx < params.size(); idx++){
+			ParamBytes cur = params[idx].second->bytes();
+			total.value += cur.value;
+			total.gradient += cur.gradient;
+			total.optimizer += cur.optimizer;
+		}
+		return total;
+	}
+
+	//the nodes of builders in a pool are counted in both
+	inline size_t builderBytes() const {
+		size_t total = 0;
+		for (int idx = 0; idx < builders.size(); idx++){
+			total += builders[idx].second();
+		}
+		return total;
+	}
+
+	inline void dump(std::ostream& os) const {
+		os << "{\n\"pools\":[";
+		for (int idx = 0; idx < pools.size(); idx++){
+			const AlignedMemoryPool* pool = pools[idx].second;
+			if (idx > 0) os << ",";
+			os << "\n{\"name\":\"" << json_escape(pools[idx].first) << "\",\"allocated\":" << pool->allocated()
+				<< ",\"peak\":" << pool->peak() << ",\"reserved\":" << pool->reserved()
+				<< ",\"chunks\":" << pool->capacity << ",\"fallbacks\":" << pool->fallbacks
+				<< ",\"fallback_bytes\":" << pool->fallback_bytes << "}";
+		}
+		os << "\n],\n\"params\":[";
+		for (int idx = 0; idx < params.size(); idx++){
+			ParamBytes cur = params[idx].second->bytes();
+			if (idx > 0) os << ",";
+			os << "\n{\"name\":\"" << json_escape(params[idx].first) << "\",\"value\":" << cur.value
+				<< ",\"gradient\":" << cur.gradient << ",\"optimizer\":" << cur.optimizer << "}";
+		}
+		os << "\n],\n\"builders\":[";
+		for (int idx = 0; idx < builders.size(); idx++){
+			if (idx > 0) os << ",";
+			os << "\n{\"name\":\"" << json_escape(builders[idx].first) << "\",\"bytes\":" << builders[idx].second() << "}";
+		}
+		ParamBytes total = paramBytes();
+		os << "\n],\n\"total\":{\"pools\":" << poolBytes() << ",\"params\":" << total.total()
+			<< ",\"builders\":" << builderBytes() << "}\n}" << std::endl;
+	}
+
+	inline void dump(const string& file) const {
+		std::ofstream os(file.c_str());
+		if (!os.is_open()){
+			std::cout << "memory stats error: can not open " << file << std::endl;
+			return;
+		}
+		dump(os);
+		os.close();
+	}
+};
+
+#endif
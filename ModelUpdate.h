@@ -12,16 +12,18 @@
 #include "MyLib.h"
 
 
-class ModelUpdate {
+// the updates of the params of one scalar type, ModelUpdate holds those of dtype
+template<typename T>
+class ModelUpdateT {
 
 public:
-	vector<BaseParam*> _params;
+	vector<BaseParamT<T>*> _params;
 
-	dtype _reg, _alpha, _eps;
-	dtype _belta1, _belta2;
+	T _reg, _alpha, _eps;
+	T _belta1, _belta2;
 
 public:
-	ModelUpdate(){
+	ModelUpdateT(){
 		_params.clear();
 
 		_reg = 1e-8;
@@ -35,11 +37,11 @@ public:
 
 public:
 
-	inline void addParam(BaseParam* param){
+	inline void addParam(BaseParamT<T>* param){
 		_params.push_back(param);
 	}
 	
-	inline void addParam(const vector<BaseParam*>& params){
+	inline void addParam(const vector<BaseParamT<T>*>& params){
 		for(int idx = 0; idx < params.size(); idx++){
 			_params.push_back(params[idx]);
 		}
@@ -53,8 +55,8 @@ public:
 		}
 	}
 
-	inline void update(dtype maxScale){
-		dtype sumNorm = 0.0;
+	inline void update(T maxScale){
+		T sumNorm = 0.0;
 		for (int idx = 0; idx < _params.size(); idx++){
 			sumNorm += _params[idx]->squareGradNorm();
 		}
@@ -62,9 +64,9 @@ public:
 			clearGrad();
 			return;
 		}
-		dtype norm = sqrt(sumNorm);
+		T norm = sqrt(sumNorm);
 		if (norm > maxScale){
-			dtype scale = maxScale / norm;
+			T scale = maxScale / norm;
 			for (int idx = 0; idx < _params.size(); idx++){
 				_params[idx]->rescaleGrad(scale);
 			}
@@ -80,8 +82,8 @@ public:
 		}
 	}
 
-	inline void updateAdam(dtype maxScale) {
-		dtype sumNorm = 0.0;
+	inline void updateAdam(T maxScale) {
+		T sumNorm = 0.0;
 		for (int idx = 0; idx < _params.size(); idx++) {
 			sumNorm += _params[idx]->squareGradNorm();
 		}
@@ -89,9 +91,9 @@ public:
 			clearGrad();
 			return;
 		}
-		dtype norm = sqrt(sumNorm);
+		T norm = sqrt(sumNorm);
 		if (maxScale > 0 && norm > maxScale) {
-			dtype scale = maxScale / norm;
+			T scale = maxScale / norm;
 			for (int idx = 0; idx < _params.size(); idx++) {
 				_params[idx]->rescaleGrad(scale);
 			}
@@ -100,7 +102,7 @@ public:
 		updateAdam();
 	}
 
-    inline void rescaleGrad(dtype scale) {
+    inline void rescaleGrad(T scale) {
         for (int idx = 0; idx < _params.size(); idx++) {
             _params[idx]->rescaleGrad(scale);
         }
@@ -112,8 +114,8 @@ public:
 		}
 	}
 
-	inline void gradClip(dtype maxScale) {
-		dtype sumNorm = 0.0;
+	inline void gradClip(T maxScale) {
+		T sumNorm = 0.0;
 		for (int idx = 0; idx < _params.size(); idx++) {
 			sumNorm += _params[idx]->squareGradNorm();
 		}
@@ -121,9 +123,9 @@ public:
 			clearGrad();
 			return;
 		}
-		dtype norm = sqrt(sumNorm);
+		T norm = sqrt(sumNorm);
 		if (maxScale > 0 && norm > maxScale) {
-			dtype scale = maxScale / norm;
+			T scale = maxScale / norm;
 			for (int idx = 0; idx < _params.size(); idx++) {
 				_params[idx]->rescaleGrad(scale);
 			}
@@ -137,6 +139,6 @@ public:
 
 };
 
-
+typedef ModelUpdateT<dtype> ModelUpdate;
 
 #endif /* ModelUpdate_H_ */
@@ -23,6 +23,7 @@
 #include <ctime>
 #include <cfloat>
 #include <cstring>
+#include <cstdio>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
@@ -38,12 +39,21 @@ using namespace Eigen;
 typedef float dtype;
 typedef Eigen::TensorMap<Eigen::Tensor<float, 1>>  Vec;
 typedef Eigen::Map<MatrixXf> Mat;
+typedef MatrixXf MatBuffer;
 #else
 typedef double dtype;
 typedef Eigen::TensorMap<Eigen::Tensor<double, 1>>  Vec;
 typedef Eigen::Map<MatrixXd> Mat;
+typedef MatrixXd MatBuffer;
 #endif
 
+template<typename T> using VecT = Eigen::TensorMap<Eigen::Tensor<T, 1>>;
+template<typename T> using MatT = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> >;
+template<typename T> using MatBufferT = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+// log-space accumulation, e.g., the crf partition functions, is done in double even when dtype is float
+typedef double ltype;
+
 typedef long long blong;
 
 const static dtype minlogvalue = -1000;
@@ -227,15 +237,16 @@ inline dtype logsumexp(dtype a[], int length) {
   return max + log(sum);
 }
 
-inline dtype logsumexp(const vector<dtype>& a) {
+template<typename T>
+inline T logsumexp(const vector<T>& a) {
 	int length = a.size();
-	dtype max = a[0];
+	T max = a[0];
 	for (int idx = 1; idx < length; idx++) {
 		if (a[idx] > max)
 			max = a[idx];
 	}
 
-	dtype sum = 0;
+	T sum = 0;
 	for (int idx = 0; idx < length; idx++) {
 			sum += exp(a[idx] - max);
 	}
@@ -347,6 +358,24 @@ inline void clean_str(string &str) {
   }
 }
 
+// the string as the body of a json string, e.g., the user-given names in the profiler traces and memory stats
+inline string json_escape(const string& str) {
+  std::ostringstream os;
+  for (string::size_type i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      os << buf;
+    } else {
+      os << c;
+    }
+  }
+  return os.str();
+}
+
 inline bool my_getline(ifstream &inf, string &line) {
   if (!getline(inf, line))
     return false;
@@ -9,21 +9,25 @@
 
 using namespace Eigen;
 
-struct Tensor1D {
+// the tensors are templated on the scalar type, so that tensors of other precisions live in the same binary,
+// e.g., the double tables of the crf losses in a float build. Tensor1D and Tensor2D hold dtype as before.
+template<typename T>
+struct Tensor1DT {
 private:
 	size_t memsize;	
 	AlignedMemoryPool* mempool;
 public:
-	dtype *v;
+	T *v;
 	int dim;
 	
-	Tensor1D(){
+	Tensor1DT(){
 		memsize = 0;
 		dim = 0;
 		v = NULL;
+		mempool = NULL;
 	}
 	
-	~Tensor1D(){
+	~Tensor1DT(){
 		memsize = 0;
 		dim = 0;
 		if(!mempool){
@@ -36,12 +40,13 @@ public:
 	}
 	
 	//please call this function before using it really. must! must! must!
-	//only this function allocates memories
+	//only this function allocates memories, from the pool of the thread if mem is NULL
 	inline void init(int dim, AlignedMemoryPool* mem = NULL){
 		this->dim = dim;
 		v = NULL;
+		if(mem == NULL) mem = AlignedMemoryPool::local();
 		if(mem != NULL){
-			v = (dtype*)mem->allocate(dim * sizeof(dtype), memsize);
+			v = (T*)mem->allocate(dim * sizeof(T), memsize);
 		}
 		
 		if(v){
@@ -49,8 +54,9 @@ public:
 		}
 		else {
 			mempool = NULL;
-			v = new dtype[dim];
-			memsize = dim * sizeof(dtype);
+			v = new T[dim];
+			memsize = dim * sizeof(T);
+			if(mem) mem->fallback(memsize);
 		}
 		zero();
 	}
@@ -58,67 +64,83 @@ public:
 	inline void zero(){
 		if(v)memset((void*)v, 0, memsize);;
 	}
+
+	//frees the memory before init again, e.g., with a larger dim; memory of a pool stays there
+	inline void release(){
+		if(!mempool){
+			delete[] v;
+		}
+		mempool = NULL;
+		v = NULL;
+		memsize = 0;
+		dim = 0;
+	}
+
+	//bytes of the memory, no less than dim * sizeof(T)
+	inline size_t bytes() const {
+		return memsize;
+	}
 	
-	const Mat mat() const {
-		return Mat(v, dim, 1);
+	const MatT<T> mat() const {
+		return MatT<T>(v, dim, 1);
 	}
 	
-	Mat mat() {
-		return Mat(v, dim, 1);
+	MatT<T> mat() {
+		return MatT<T>(v, dim, 1);
 	}	
 	
-	const Mat tmat() const {
-		return Mat(v, 1, dim);
+	const MatT<T> tmat() const {
+		return MatT<T>(v, 1, dim);
 	}
 	
-	Mat tmat() {
-		return Mat(v, 1, dim);
+	MatT<T> tmat() {
+		return MatT<T>(v, 1, dim);
 	}
 	
-	const Vec vec() const {
-		return Vec(v, dim);
+	const VecT<T> vec() const {
+		return VecT<T>(v, dim);
 	}
 	
-	Vec vec() {
-		return Vec(v, dim);
+	VecT<T> vec() {
+		return VecT<T>(v, dim);
 	}
 	
-	inline dtype& operator[](const int i) { 
+	inline T& operator[](const int i) { 
 	  return v[i];  // no boundary check?
 	}
 
-	inline const dtype& operator[](const int i) const{
+	inline const T& operator[](const int i) const{
 		return v[i];  // no boundary check?
 	}
 	
-	inline Tensor1D& operator=(const dtype &a) { // assign a to every element
+	inline Tensor1DT& operator=(const T &a) { // assign a to every element
 	  for (int i = 0; i < dim; i++)
 	    v[i] = a;
 	  return *this;
 	}
 	
-	inline Tensor1D& operator=(const vector<dtype> &a) { // assign a to every element
+	inline Tensor1DT& operator=(const vector<T> &a) { // assign a to every element
 	  for (int i = 0; i < dim; i++)
 	    v[i] = a[i];
 	  return *this;
 	}
 	
-	inline Tensor1D& operator=(const NRVec<dtype> &a) { // assign a to every element
+	inline Tensor1DT& operator=(const NRVec<T> &a) { // assign a to every element
 	  for (int i = 0; i < dim; i++)
 	    v[i] = a[i];
 	  return *this;
 	}
 	
-	inline Tensor1D& operator=(const Tensor1D &a) { // assign a to every element
+	inline Tensor1DT& operator=(const Tensor1DT &a) { // assign a to every element
 	  for (int i = 0; i < dim; i++)
 	    v[i] = a[i];
 	  return *this;
 	}
 	
-	inline void random(dtype bound){
-		dtype min = -bound, max = bound;
+	inline void random(T bound){
+		T min = -bound, max = bound;
 		for (int i = 0; i < dim; i++){			
-			v[i] =  (dtype(rand()) / RAND_MAX) * (max - min) + min;
+			v[i] =  (T(rand()) / RAND_MAX) * (max - min) + min;
 		}
 	}
 
@@ -142,27 +164,33 @@ public:
 	
 };
 
+typedef Tensor1DT<dtype> Tensor1D;
+
 
-struct Tensor2D {
+template<typename T>
+struct Tensor2DT {
 private:
 	size_t memsize;	
 	AlignedMemoryPool* mempool;
+	bool shared;  //the memory is owned by another tensor
 public:
-	dtype *v;
+	T *v;
 	int col, row, size;
 	
-	Tensor2D(){
+	Tensor2DT(){
 		memsize = 0;
 		col = row = 0;
 		size = 0;
 		v = NULL;
+		mempool = NULL;
+		shared = false;
 	}
 
-	~Tensor2D(){
+	~Tensor2DT(){
 		memsize = 0;
 		col = row = 0;
 		size = 0;
-		if(!mempool){
+		if(!mempool && !shared){
 			delete[] v;
 		}
 		else{
@@ -178,7 +206,7 @@ public:
 		this->row = row;
 		size = col * row;
 		if(mem){
-			v = (dtype*)mem->allocate(size * sizeof(dtype), memsize);
+			v = (T*)mem->allocate(size * sizeof(T), memsize);
 		}
 		
 		if(v){
@@ -186,8 +214,9 @@ public:
 		}
 		else {
 			mempool = NULL;
-			v = new dtype[size];
-			memsize = size * sizeof(dtype);
+			v = new T[size];
+			memsize = size * sizeof(T);
+			if(mem) mem->fallback(memsize);
 		}
 		zero();
 	}
@@ -195,47 +224,82 @@ public:
 	inline void zero(){
 		if(v)memset((void*)v, 0, memsize);;
 	}
+
+	//frees the memory before init again, e.g., with more cols; memory of a pool stays there
+	inline void release(){
+		if(!mempool && !shared){
+			delete[] v;
+		}
+		mempool = NULL;
+		shared = false;
+		v = NULL;
+		memsize = 0;
+		col = row = 0;
+		size = 0;
+	}
+
+	//bytes of its own memory, none if shared
+	inline size_t bytes() const {
+		return shared ? 0 : memsize;
+	}
+
+	//use the memory of other instead of its own, other must outlive this tensor
+	inline void share(const Tensor2DT& other){
+		if (other.row != row || other.col != col) {
+			std::cout << "warning: shared tensor dims do not match." << std::endl;
+		}
+		if (!mempool && !shared) {
+			delete[] v;
+		}
+		v = other.v;
+		row = other.row;
+		col = other.col;
+		size = other.size;
+		memsize = other.memsize;
+		mempool = NULL;
+		shared = true;
+	}
 	
-	const Mat mat() const {
-		return Mat(v, row, col);
+	const MatT<T> mat() const {
+		return MatT<T>(v, row, col);
 	}
 	
-	Mat mat() {
-		return Mat(v, row, col);
+	MatT<T> mat() {
+		return MatT<T>(v, row, col);
 	}
 	
-	const Vec vec() const {
-		return Vec(v, size);
+	const VecT<T> vec() const {
+		return VecT<T>(v, size);
 	}
 	
-	Vec vec() {
-		return Vec(v, size);
+	VecT<T> vec() {
+		return VecT<T>(v, size);
 	}
 
 	
 	//use it carefully, first col, then row, because rows are allocated successively
-	inline dtype* operator[](const int icol) {
+	inline T* operator[](const int icol) {
 	  return &(v[icol*row]);  // no boundary check?
 	}
 	
-	inline const dtype* operator[](const int icol) const {
+	inline const T* operator[](const int icol) const {
 	  return &(v[icol*row]);  // no boundary check?
 	}
 	
 	//use it carefully
-	inline Tensor2D& operator=(const dtype &a) { // assign a to every element
+	inline Tensor2DT& operator=(const T &a) { // assign a to every element
 	  for (int i = 0; i < size; i++)
 	    v[i] = a;
 	  return *this;
 	}
 	
-	inline Tensor2D& operator=(const vector<dtype> &a) { // assign a to every element
+	inline Tensor2DT& operator=(const vector<T> &a) { // assign a to every element
 	  for (int i = 0; i < size; i++)
 	    v[i] = a[i];
 	  return *this;
 	}
 	
-	inline Tensor2D& operator=(const vector<vector<dtype> > &a) { // assign a to every element
+	inline Tensor2DT& operator=(const vector<vector<T> > &a) { // assign a to every element
 		int offset = 0;
 	  for (int i = 0; i < row; i++){
 	  	for (int j = 0; j < col; j++) {
@@ -246,7 +310,7 @@ public:
 	  return *this;
 	}
 	
-	inline Tensor2D& operator=(const NRMat<dtype> &a) { // assign a to every element
+	inline Tensor2DT& operator=(const NRMat<T> &a) { // assign a to every element
 		int offset = 0;
 	  for (int i = 0; i < row; i++){
 	  	for (int j = 0; j < col; j++) {
@@ -257,27 +321,27 @@ public:
 	  return *this;
 	}
 	
-	inline Tensor2D& operator=(const Tensor2D &a) { // assign a to every element
+	inline Tensor2DT& operator=(const Tensor2DT &a) { // assign a to every element
 	  for (int i = 0; i < size; i++)
 	    v[i] = a.v[i];
 	  return *this;
 	}
 	
-	inline void random(dtype bound){
-		dtype min = -bound, max = bound;
+	inline void random(T bound){
+		T min = -bound, max = bound;
 		for (int i = 0; i < size; i++){			
-			v[i] =  (dtype(rand()) / RAND_MAX) * (max - min) + min;
+			v[i] =  (T(rand()) / RAND_MAX) * (max - min) + min;
 		}
 	}
 
 	inline void norm2one() { //every col is normalized (for embeddings only)
-		dtype sum;
+		T sum;
 		for (int idx = 0; idx < col; idx++) {
 			sum = 0.000001;
 			for (int idy = 0; idy < row; idy++) {
 				sum += (*this)[idx][idy] * (*this)[idx][idy];
 			}
-			dtype scale = sqrt(sum);
+			T scale = sqrt(sum);
 			for (int idy = 0; idy < row; idy++) {
 				(*this)[idx][idy] /= scale;
 			}
@@ -307,51 +371,142 @@ public:
 
 };
 
+typedef Tensor2DT<dtype> Tensor2D;
 
-//useful functions
-inline dtype fequal(const dtype& x) {
+
+//useful functions, of the scalar type of the nodes calling them
+template<typename T>
+inline T fequal(const T& x) {
 	return x;
 }
 
-inline dtype ftanh(const dtype& x) {
+template<typename T>
+inline T ftanh(const T& x) {
 	return tanh(x);
 }
 
-inline dtype fsigmoid(const dtype& x) {
+template<typename T>
+inline T fsigmoid(const T& x) {
 	return 1.0 / (1.0 + exp(-x));
 }
 
-inline dtype frelu(const dtype& x) {
+template<typename T>
+inline T frelu(const T& x) {
 	if (x <= 0) return 0;
 	return x;
 }
 
-inline dtype fexp(const dtype& x) {
+template<typename T>
+inline T fexp(const T& x) {
 	return exp(x);
 }
 
 //derive function
-inline dtype dequal(const dtype& x, const dtype& y) {
+template<typename T>
+inline T dequal(const T& x, const T& y) {
 	return 1;
 }
 
-inline dtype dtanh(const dtype& x, const dtype& y) {
+template<typename T>
+inline T dtanh(const T& x, const T& y) {
 	return (1 + y) * (1 - y);
 }
 
-inline dtype dsigmoid(const dtype& x, const dtype& y) {
+template<typename T>
+inline T dsigmoid(const T& x, const T& y) {
 	return (1 - y) * y;
 }
 
-inline dtype drelu(const dtype& x, const dtype& y) {
+template<typename T>
+inline T drelu(const T& x, const T& y) {
 	if (x <= 0) return 0;
 	return 1;
 }
 
-inline dtype dexp(const dtype& x, const dtype& y) {
+template<typename T>
+inline T dexp(const T& x, const T& y) {
 	return y;
 }
 
+// the functions above are recognized once per node and applied by the vectorized kernels of eigen
+// (packet exp and logistic, the rational tanh of float), instead of a call through the pointer per element.
+// other functions still go through their pointers.
+enum ActivationType {
+	ACT_OTHER = 0,
+	ACT_EQUAL,
+	ACT_TANH,
+	ACT_SIGMOID,
+	ACT_RELU,
+	ACT_EXP
+};
+
+template<typename T>
+inline ActivationType activation_of(T (*f)(const T&)) {
+	if (f == &ftanh<T>) return ACT_TANH;
+	if (f == &fsigmoid<T>) return ACT_SIGMOID;
+	if (f == &frelu<T>) return ACT_RELU;
+	if (f == &fequal<T>) return ACT_EQUAL;
+	if (f == &fexp<T>) return ACT_EXP;
+	return ACT_OTHER;
+}
+
+template<typename T>
+inline ActivationType activation_of(T (*f)(const T&, const T&)) {
+	if (f == &dtanh<T>) return ACT_TANH;
+	if (f == &dsigmoid<T>) return ACT_SIGMOID;
+	if (f == &drelu<T>) return ACT_RELU;
+	if (f == &dequal<T>) return ACT_EQUAL;
+	if (f == &dexp<T>) return ACT_EXP;
+	return ACT_OTHER;
+}
+
+inline void tanh_forward(const VecT<float>& x, VecT<float> y) {
+	y = x.tanh();
+}
+
+//eigen has no packet tanh of double, 1 - 2 / (exp(2x) + 1) is off by about 1e-16 in absolute
+inline void tanh_forward(const VecT<double>& x, VecT<double> y) {
+	y = x.constant(1) - x.constant(2) / ((x * x.constant(2)).exp() + x.constant(1));
+}
+
+//y = f(x)
+template<typename T>
+inline void activate_forward(T (*f)(const T&), const VecT<T>& x, VecT<T> y) {
+	switch (activation_of(f)) {
+	case ACT_TANH: tanh_forward(x, y); break;
+	case ACT_SIGMOID: y = x.sigmoid(); break;
+	case ACT_RELU: y = x.cwiseMax((T)0); break;
+	case ACT_EQUAL: y = x; break;
+	case ACT_EXP: y = x.exp(); break;
+	default: y = x.unaryExpr(ptr_fun(f));
+	}
+}
+
+template<typename T>
+inline void activate_forward(T (*f)(const T&), const Tensor1DT<T>& x, Tensor1DT<T>& y) {
+	activate_forward(f, x.vec(), y.vec());
+}
+
+template<typename T, typename Expr>
+inline void assign_or_add(VecT<T> dst, const Expr& expr, bool add) {
+	if (add) dst += expr;
+	else dst = expr;
+}
+
+//lx = ly * f'(x, y), or lx += ly * f'(x, y) if add
+template<typename T>
+inline void activate_backward(T (*f)(const T&, const T&), const Tensor1DT<T>& x, const Tensor1DT<T>& y,
+	const Tensor1DT<T>& ly, Tensor1DT<T>& lx, bool add) {
+	switch (activation_of(f)) {
+	case ACT_TANH: assign_or_add(lx.vec(), ly.vec() * (y.vec().constant(1) + y.vec()) * (y.vec().constant(1) - y.vec()), add); break;
+	case ACT_SIGMOID: assign_or_add(lx.vec(), ly.vec() * (y.vec().constant(1) - y.vec()) * y.vec(), add); break;
+	case ACT_RELU: assign_or_add(lx.vec(), (x.vec() > x.vec().constant(0)).select(ly.vec(), ly.vec().constant(0)), add); break;
+	case ACT_EQUAL: assign_or_add(lx.vec(), ly.vec(), add); break;
+	case ACT_EXP: assign_or_add(lx.vec(), ly.vec() * y.vec(), add); break;
+	default: assign_or_add(lx.vec(), ly.vec() * x.vec().binaryExpr(y.vec(), ptr_fun(f)), add);
+	}
+}
+
 
 
 
@@ -25,17 +25,35 @@
 #include "SemiCRFMLLoss.h"
 #include "LSTM.h"
 #include "LSTM1.h"
+#include "SeqProj.h"
+#include "LSTMCell.h"
 #include "AtomicOP.h"
 #include "APCOP.h"
 #include "SparseCOP.h"
 #include "COPUtils.h"
 #include "RNN.h"
 #include "GRNN.h"
+#include "GRUCell.h"
+#include "BiCell.h"
+#include "LSTMBatch.h"
 #include "MyTensor.h"
 #include "SoftmaxOP.h"
 #include "GatedPooling.h"
 #include "AttRecursiveGatedNN.h"
 #include "TransferOP.h"
+#include "ThreadPool.h"
+#include "DataParallel.h"
+#include "Hogwild.h"
+#include "Profiler.h"
+#include "MemoryPlan.h"
+#include "ParallelBackward.h"
+#include "ScratchArena.h"
+#include "MemoryStats.h"
+#include "Numa.h"
+#include "HalfParam.h"
+#include "HalfOP.h"
+#include "QuantParam.h"
+#include "QuantOP.h"
 
 
 #endif
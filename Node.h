@@ -1,15 +1,72 @@
 #ifndef BasicNode
 #define BasicNode
 
+#include <atomic>
 #include "MyTensor.h"
 
+// inference only, of the nodes initialized and the graphs created by this thread from then on, e.g., for a decoder in serving.
+// each node keeps the mode it was initialized in (Node::inference): it allocates no loss buffers (loss, lty)
+// and does no lock bookkeeping. each graph keeps the mode it was created in (Graph::inference): it keeps no
+// execs and can not run backward. the intermediate values are released once their consumers have run only
+// under a memory plan, see Graph::useMemoryPlan. the other threads, e.g., training the model, are not affected.
+inline bool& inference_only(){
+	static thread_local bool only = false;
+	return only;
+}
+
+template<typename T>
+struct NodeT;
+
+// the graph holding deferred nodes, which computes them all before one of them is read, see Node::settle
+struct DeferredQueue {
+	virtual void flush() = 0;
+};
+
+// counter-based random bits of (seed, index) by splitmix64, for the dropout masks
+inline unsigned long long drop_bits(unsigned long long seed, int index){
+	unsigned long long z = seed + (unsigned long long)(index + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// the state of the random bits of this thread for the nodes (ids, dropout seeds, checks), as rand() is not
+// thread-safe and nodes are built on the workers, e.g., of DataParallel. each thread starts from its own seed,
+// in the order the threads first draw, and may be assigned to reproduce its dropout masks
+inline unsigned long long& thread_seed(){
+	static std::atomic<int> threads(0);
+	static thread_local unsigned long long state = drop_bits(0x2545F4914F6CDD1DULL, threads++);
+	return state;
+}
+
+inline unsigned long long thread_rand(){
+	unsigned long long& state = thread_seed();
+	state += 0x9E3779B97F4A7C15ULL;
+	return drop_bits(state, 0);
+}
+
+// the graph told of each input read by the node being built, see MemoryPlan
+template<typename T>
+struct InputTrackerT {
+	virtual void read(NodeT<T>* x) = 0;
+};
+
+// when set, increase_loc reports the inputs of the node being built here, one for the nodes of each scalar type
+template<typename T>
+inline InputTrackerT<T>*& input_tracker(){
+	static thread_local InputTrackerT<T>* tracker = NULL;
+	return tracker;
+}
 
 // one Node means a vector
 // the col should be 1, because we aimed for NLP only
-struct Node {
+// the nodes are templated on the scalar type of their values, Node holds dtype as before
+template<typename T>
+struct NodeT {
 public:
-	Tensor1D val;
-	Tensor1D loss;
+	typedef T Scalar;
+	Tensor1DT<T> val;
+	Tensor1DT<T> loss;
 public:
 	int dim;
 	int lock;  //node can backward only when lock = 0;
@@ -17,23 +74,32 @@ public:
 	int sid;
 	bool lossed;
 	bool executed;
+	bool pending;  //registered in a batched graph, but not computed yet
+	bool inference;  //initialized for inference only, without loss buffers
+	DeferredQueue* queue;  //the graph it is pending in
+	unsigned epoch;  //the epoch of the lazy graph it was last reset in
 
 //for dropout only
 public:
-	Tensor1D mask;
 	bool usedrop;
-	dtype dropvalue;
+	T dropvalue;
+	unsigned long long dropseed;  //the mask of the current example, regenerated in backward
 	
 public:
-	Node(){
+	NodeT(){
 		dim = 0;
 		lock = 0;
-		sid = rand();
+		sid = (int)(thread_rand() >> 33);
 
 		lossed = false;
 		executed = false;
+		pending = false;
+		inference = false;
+		queue = NULL;
+		epoch = 0;
 		usedrop = false;
 		dropvalue = -1.0;
+		dropseed = 0;
 	}
 
 public:
@@ -43,33 +109,94 @@ public:
 		lock = 0;
 		lossed = false;
 		executed = false;
+		pending = false;
 	}
 	
-	virtual inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+	//the forward rewrites val and everything else reset by clearValue except loss,
+	//so a lazy graph only needs reuse() before the node is added
+	virtual inline bool overwrites() const {
+		return false;
+	}
+
+	inline void reuse(){
+		loss = 0;
+		lock = 0;
+		lossed = false;
+	}
+
+	virtual inline void init(int dim, T dropOut, AlignedMemoryPool* mem = NULL){
 		this->dim = dim;
 		val.init(dim, mem);
-		loss.init(dim, mem);
 		if (dropOut >= 0 && dropOut <= 1){
 			dropvalue = dropOut;
 			usedrop = true;
-			mask.init(dim, mem);
 		}
 		else{
 			dropvalue = -1;
 			usedrop = false;
 		}
-		
+		inference = inference_only();
+		if (inference) return;
+		loss.init(dim, mem);
+	}
+
+	//bytes of the tensors of this node
+	virtual inline size_t bytes() const {
+		return val.bytes() + loss.bytes();
 	}
 
 	virtual inline void backward(){
 	}
 
+//for batched execution only
+public:
+	//nodes of the same type sharing the same key are computed together
+	virtual inline const void* paramKey() const {
+		return NULL;
+	}
+
+	//approximate forward flops for profiling
+	virtual inline double flops() const {
+		return dim;
+	}
+
+	//compute val of a deferred node, inputs are set by forward
+	virtual inline void compute(){
+	}
+
+	//batch contains nodes of the same type and key, this node included
+	virtual inline void forward_batch(const vector<NodeT*>& batch){
+		int count = batch.size();
+		for (int idx = 0; idx < count; idx++){
+			batch[idx]->compute();
+		}
+	}
+
+	//batch contains the lossed nodes only, dropout has been applied
+	virtual inline void backward_batch(const vector<NodeT*>& batch){
+		int count = batch.size();
+		for (int idx = count - 1; idx >= 0; idx--){
+			batch[idx]->backward();
+		}
+	}
+
     virtual inline void set_bucket() {
         executed = true;
     }
 
-    //increace the lock by one
+    //computes the node if it is still deferred, call it before reading val (increase_loc does)
+    inline void settle() {
+        if (!pending) return;
+        if (queue) queue->flush();
+        if (pending) std::cout << "bug exist: a deferred node is read before computed, id = " << sid << std::endl;
+    }
+
+    //increace the lock by one, the node is read right after it
     virtual inline void increase_loc() {
+        settle();
+        InputTrackerT<T>* tracker = input_tracker<T>();
+        if (tracker) tracker->read(this);
+        if (inference) return;
         if (!executed) {
             std::cout << "bug exist: a node is called without being excuted, id = " << sid << std::endl;
             return;
@@ -89,33 +216,59 @@ public:
 	virtual inline void unlock(){
 	}
 
+	// each element is dropped with probability dropvalue, by a mask drawn from dropseed,
+	// so no mask is stored. the values are scaled by 1 - dropvalue in test.
 	inline void applydrop_forward(bool train){
+		drawmask(train);
+		applydrop_drawn(train);
+	}
+
+	//the seed of the mask of the current example, by the thread adding the node to its graph
+	inline void drawmask(bool train){
+		if (usedrop && train){
+			dropseed = thread_rand();
+		}
+	}
+
+	//applydrop_forward with the seed drawn already, e.g., for nodes computed on other threads
+	inline void applydrop_drawn(bool train){
 		if (usedrop)
-		{			
+		{
 			if (train){
-				mask = 1;
-				std::vector<int> indexes;
-				for (int i = 0; i < val.dim; ++i)
-					indexes.push_back(i);
-
-				int dropNum = (int)(val.dim * dropvalue);
-				random_shuffle(indexes.begin(), indexes.end());
-				for (int i = 0; i < dropNum; i++){
-					mask[indexes[i]] = 0.0;
-				}
+				applymask(val);
 			}
 			else{
-				mask = 1.0 - dropvalue;
+				val.vec() = val.vec() * (1 - dropvalue);
 			}
-
-			val.vec() = val.vec() * mask.vec();
 		}
 	}
 
 	inline void applydrop_backward(){
 		if (usedrop)
 		{
-			loss.vec() = loss.vec() * mask.vec();
+			applymask(loss);
+		}
+	}
+
+	//by blocks of elements: each 64-bit draw gives the 32-bit uniforms of two, compared with the threshold at once
+	inline void applymask(Tensor1DT<T>& x) const {
+		if (dropvalue >= 1){
+			x.mat().setZero();
+			return;
+		}
+		const unsigned threshold = (unsigned)(dropvalue * 4294967296.0);
+		const int block = 64;
+		unsigned draws[block];
+		for (int start = 0; start < x.dim; start += block){
+			int size = x.dim - start < block ? x.dim - start : block;
+			for (int idx = 0; 2 * idx < size; idx++){
+				unsigned long long bits = drop_bits(dropseed, start / 2 + idx);
+				draws[2 * idx] = (unsigned)bits;
+				draws[2 * idx + 1] = (unsigned)(bits >> 32);
+			}
+			Map<Array<unsigned, Dynamic, 1> > uniforms(draws, size);
+			MatT<T> values(x.v + start, size, 1);
+			values.array() = (uniforms < threshold).select(T(0), values.array());
 		}
 	}
 
@@ -123,8 +276,46 @@ public:
 
 };
 
+typedef NodeT<dtype> Node;
 typedef  Node* PNode;
 
+// computes the deferred ones of the nodes, e.g., before a loss reads them
+template<typename T>
+inline void settle_nodes(const vector<NodeT<T>*>& xs){
+	for (int idx = 0; idx < xs.size(); idx++){
+		xs[idx]->settle();
+	}
+}
+
+// bytes of the tensors of the nodes of a builder, which its bytes() adds up
+template<typename DerivedNode>
+inline size_t nodeBytes(const vector<DerivedNode>& nodes){
+	size_t total = 0;
+	for (int idx = 0; idx < nodes.size(); idx++){
+		total += nodes[idx].bytes();
+	}
+	return total;
+}
+
+// the reserve(size) of a builder: the tensors of its nodes are allocated on demand, in geometric chunks
+// up to maxsize, and reserve(maxsize) allocates all of them at once, e.g., when the pool is sized by measure.
+// capacity counts the steps allocated, alloc(idx, mem) allocates those of the step idx. it may run in forward,
+// on a worker sharing mem with the other replicas, so the pool is the one given by AlignedMemoryPool::growth
+template<typename Alloc>
+inline bool reserveNodes(const char* name, int size, int maxsize, int& capacity, AlignedMemoryPool* mem, Alloc alloc){
+	if (size > maxsize) {
+		std::cout << name << " error: " << size << " inputs exceed the " << maxsize << " nodes, resize first" << std::endl;
+		return false;
+	}
+	if (size <= capacity) return true;
+	if (size < 2 * capacity) size = 2 * capacity < maxsize ? 2 * capacity : maxsize;
+	AlignedMemoryPool* pool = AlignedMemoryPool::growth(mem);
+	for (int idx = capacity; idx < size; idx++) {
+		alloc(idx, pool);
+	}
+	capacity = size;
+	return true;
+}
 
 
 
@@ -0,0 +1,144 @@
+#ifndef N3L_NUMA_H
+#define N3L_NUMA_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <thread>
+#if !_WINDOWS
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "Mem.h"
+#include "ThreadPool.h"
+
+// the numa nodes of the machine and their cpus, read from sysfs.
+// a machine without numa information has one node holding all the cpus.
+class NumaTopology {
+public:
+	vector<vector<int> > cpus;  //of each node
+
+public:
+	NumaTopology() {
+		load();
+	}
+
+	inline void load() {
+		cpus.clear();
+#if !_WINDOWS
+		for (int node = 0; ; node++) {
+			std::stringstream path;
+			path << "/sys/devices/system/node/node" << node << "/cpulist";
+			std::ifstream is(path.str().c_str());
+			if (!is.is_open()) break;
+			string list;
+			std::getline(is, list);
+			cpus.push_back(parse(list));
+		}
+#endif
+		if (cpus.empty()) {
+			cpus.push_back(vector<int>());
+			int count = std::thread::hardware_concurrency();
+			for (int idx = 0; idx < count; idx++) cpus[0].push_back(idx);
+		}
+	}
+
+	inline int nodes() const {
+		return cpus.size();
+	}
+
+	//e.g., "0-3,8-11"
+	static inline vector<int> parse(const string& list) {
+		vector<int> res;
+		std::stringstream ss(list);
+		string range;
+		while (std::getline(ss, range, ',')) {
+			if (range.empty()) continue;
+			int first = -1, last = -1;
+			if (sscanf(range.c_str(), "%d-%d", &first, &last) == 1) last = first;
+			for (int idx = first; idx >= 0 && idx <= last; idx++) res.push_back(idx);
+		}
+		return res;
+	}
+};
+
+// binds the calling thread to the given cpus, returns false if the system refuses
+inline bool pinThread(const vector<int>& cpus) {
+#if !_WINDOWS
+	if (cpus.empty()) return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int idx = 0; idx < cpus.size(); idx++) {
+		if (cpus[idx] < CPU_SETSIZE) CPU_SET(cpus[idx], &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+// one memory pool for every worker of a thread pool, on the numa node of the worker.
+// the workers are spread over the nodes in turn and pinned to the cpus of their node;
+// each pool prefers its node and becomes AlignedMemoryPool::local() of its worker,
+// so the nodes of the builders and graphs initialized in a task of the workers
+// (e.g., the replicas of DataParallelTrainer) are allocated and first touched locally.
+//	LocalMemory memory;
+//	memory.init(*trainer._pool, 1, 1 << 28);
+//	trainer._pool->run([&](int worker) { replicas[worker].initial(); });
+class LocalMemory {
+public:
+	NumaTopology topology;
+	vector<AlignedMemoryPool*> pools;  //of each worker
+	vector<int> nodes;  //the numa node of each worker
+	ThreadPool* threads;
+
+public:
+	LocalMemory() {
+		threads = NULL;
+	}
+
+	~LocalMemory() {
+		clear();
+	}
+
+	//the pools must outlive the tensors taken from them, and the workers must outlive the pools
+	inline void clear() {
+		if (threads) {
+			threads->run([](int worker) {
+				AlignedMemoryPool::local() = NULL;
+			});
+		}
+		threads = NULL;
+		for (int idx = 0; idx < pools.size(); idx++) {
+			delete pools[idx];
+		}
+		pools.clear();
+		nodes.clear();
+	}
+
+	// cap chunks of unit bytes for each worker, pin = false keeps the workers unbound
+	inline void init(ThreadPool& workers, size_t cap, size_t unit, bool pin = true, bool huge = false) {
+		clear();
+		threads = &workers;
+		int count = workers.size();
+		pools.resize(count, NULL);
+		nodes.resize(count);
+		int numaNodes = topology.nodes();
+		for (int idx = 0; idx < count; idx++) {
+			nodes[idx] = idx % numaNodes;
+		}
+		workers.run([&](int worker) {
+			int node = nodes[worker];
+			if (pin && !pinThread(topology.cpus[node])) {
+				std::cout << "numa warning: worker " << worker << " can not be pinned to node " << node << std::endl;
+			}
+			pools[worker] = new AlignedMemoryPool(cap, unit, huge, numaNodes > 1 ? node : -1);
+			AlignedMemoryPool::local() = pools[worker];
+		});
+	}
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef N3L_PARALLELBACKWARD_H
+#define N3L_PARALLELBACKWARD_H
+
+#include <map>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "Node.h"
+#include "ThreadPool.h"
+
+// backward of a graph over the workers of a pool, driven by the node locks:
+// a node runs backward once its lock reaches zero, i.e., all its consumers have run.
+// two nodes writing the same memory never run together, they conflict when they share
+// an input (both add to its loss) or a param set (both add to its gradients, see paramKey).
+// every worker keeps its own deque of ready nodes, it takes the last node it released
+// and steals the oldest ones of the others when its own is empty.
+// the scheduling is under one mutex, so it pays off for nodes with enough work, e.g., matrix products.
+template<typename T>
+class ParallelBackwardT {
+protected:
+	typedef NodeT<T>* PNode;
+
+	const vector<PNode>* execs;
+	const vector<vector<PNode> >* inputs;
+	vector<vector<const void*> > resources;  //inputs and param set of each node
+	map<PNode, int> positions;
+	vector<bool> queued;
+	vector<deque<int> > ready;  //one for each worker
+	set<const void*> busy;
+	std::mutex mtx;
+	std::condition_variable changed;
+	int left, running;
+
+public:
+	// execs and their inputs as tracked in forward, done[idx] is set for the processed nodes.
+	// the nodes left undone are still locked, the graph handles them as before.
+	inline void run(const vector<PNode>& nodes, const vector<vector<PNode> >& nodeInputs, ThreadPool& pool, vector<bool>& done){
+		execs = &nodes;
+		inputs = &nodeInputs;
+		int count = nodes.size();
+		positions.clear();
+		resources.resize(count);
+		for (int idx = 0; idx < count; idx++){
+			positions[nodes[idx]] = idx;
+			vector<const void*>& res = resources[idx];
+			res.clear();
+			for (int idy = 0; idy < nodeInputs[idx].size(); idy++){
+				res.push_back(nodeInputs[idx][idy]);
+			}
+			if (nodes[idx]->paramKey() != NULL){
+				res.push_back(nodes[idx]->paramKey());
+			}
+		}
+
+		int workers = pool.size();
+		ready.assign(workers, deque<int>());
+		queued.assign(count, false);
+		busy.clear();
+		for (int idx = count - 1, worker = 0; idx >= 0; idx--){
+			if (nodes[idx]->lock == 0){
+				queued[idx] = true;
+				ready[worker].push_back(idx);
+				worker = (worker + 1) % workers;
+			}
+		}
+		left = count;
+		running = 0;
+		done.assign(count, false);
+
+		pool.run([&](int worker) {
+			work(worker, done);
+		});
+	}
+
+protected:
+	inline void work(int worker, vector<bool>& done){
+		std::unique_lock<std::mutex> guard(mtx);
+		while (left > 0){
+			int cur = take(worker);
+			if (cur < 0){
+				if (running == 0) break;  //the rest are still locked, a bug of the graph
+				changed.wait(guard);
+				continue;
+			}
+			vector<const void*>& res = resources[cur];
+			for (int idx = 0; idx < res.size(); idx++) busy.insert(res[idx]);
+			running++;
+			guard.unlock();
+
+			PNode x = (*execs)[cur];
+			if (x->lossed){
+				x->applydrop_backward();
+				x->backward();
+			}
+
+			guard.lock();
+			for (int idx = 0; idx < res.size(); idx++) busy.erase(res[idx]);
+			running--;
+			x->unlock();
+			done[cur] = true;
+			left--;
+			const vector<PNode>& ins = (*inputs)[cur];
+			for (int idx = 0; idx < ins.size(); idx++){
+				typename map<PNode, int>::iterator it = positions.find(ins[idx]);
+				if (it != positions.end() && !queued[it->second] && ins[idx]->lock == 0){
+					queued[it->second] = true;
+					ready[worker].push_back(it->second);
+				}
+			}
+			changed.notify_all();
+		}
+		changed.notify_all();
+	}
+
+	//the newest of its own, or the oldest of the others, skipping the conflicting ones
+	inline int take(int worker){
+		int workers = ready.size();
+		for (int step = 0; step < workers; step++){
+			deque<int>& dq = ready[(worker + step) % workers];
+			if (step == 0){
+				for (int idx = dq.size() - 1; idx >= 0; idx--){
+					if (free(dq[idx])){
+						int cur = dq[idx];
+						dq.erase(dq.begin() + idx);
+						return cur;
+					}
+				}
+			}
+			else{
+				for (int idx = 0; idx < dq.size(); idx++){
+					if (free(dq[idx])){
+						int cur = dq[idx];
+						dq.erase(dq.begin() + idx);
+						return cur;
+					}
+				}
+			}
+		}
+		return -1;
+	}
+
+	inline bool free(int cur) const {
+		const vector<const void*>& res = resources[cur];
+		for (int idx = 0; idx < res.size(); idx++){
+			if (busy.find(res[idx]) != busy.end()) return false;
+		}
+		return true;
+	}
+};
+
+typedef ParallelBackwardT<dtype> ParallelBackward;
+
+#endif
@@ -12,9 +12,13 @@
 #include "BaseParam.h"
 
  // Notice: aux is an auxiliary variable to help parameter updating
-struct Param : BaseParam {
-	Tensor2D aux_square;
-	Tensor2D aux_mean;
+template<typename T>
+struct ParamT : BaseParamT<T> {
+	using BaseParamT<T>::val;
+	using BaseParamT<T>::grad;
+
+	Tensor2DT<T> aux_square;
+	Tensor2DT<T> aux_mean;
 	int iter;
 
 	// allow sparse and dense parameters have different parameter initialization methods
@@ -24,7 +28,7 @@ struct Param : BaseParam {
 		aux_square.init(outDim, inDim, mem);
 		aux_mean.init(outDim, inDim, mem);
 
-		dtype bound = sqrt(6.0 / (outDim + inDim + 1));
+		T bound = sqrt(6.0 / (outDim + inDim + 1));
 		val.random(bound);
 		iter = 0;
 	}
@@ -41,17 +45,17 @@ struct Param : BaseParam {
 		grad.zero();
 	}
 
-	inline void updateAdagrad(dtype alpha, dtype reg, dtype eps) {
+	inline void updateAdagrad(T alpha, T reg, T eps) {
 		if(val.col > 1 && val.row > 1)grad.vec() = grad.vec() + val.vec() * reg;
 		aux_square.vec() = aux_square.vec() + grad.vec().square();
 		val.vec() = val.vec() - grad.vec() * alpha / (aux_square.vec() + eps).sqrt();
 	}
 
-	inline void updateAdam(dtype belta1, dtype belta2, dtype alpha, dtype reg, dtype eps) {
+	inline void updateAdam(T belta1, T belta2, T alpha, T reg, T eps) {
         if (val.col > 1 && val.row > 1)grad.vec() = grad.vec() + val.vec() * reg;
 		aux_mean.vec() = belta1 * aux_mean.vec() + (1 - belta1) * grad.vec();
 		aux_square.vec() = belta2 * aux_square.vec() + (1- belta2) * grad.vec().square();
-		dtype lr_t = alpha * sqrt(1 - pow(belta2, iter + 1)) / (1 - pow(belta1, iter + 1));
+		T lr_t = alpha * sqrt(1 - pow(belta2, iter + 1)) / (1 - pow(belta1, iter + 1));
 		val.vec() = val.vec() - aux_mean.vec() * lr_t / (aux_square.vec() + eps).sqrt();
 		iter++;
 	}
@@ -73,18 +77,30 @@ struct Param : BaseParam {
 		idx = idCols[0];
 	}
 
-	inline dtype squareGradNorm() {
-		dtype sumNorm = 0.0;
+	inline T squareGradNorm() {
+		T sumNorm = 0.0;
 		for (int i = 0; i < grad.size; i++) {
 			sumNorm += grad.v[i] * grad.v[i];
 		}
 		return sumNorm;
 	}
 
-	inline void rescaleGrad(dtype scale) {
+	inline void rescaleGrad(T scale) {
 		grad.vec() = grad.vec() * scale;
 	}
 
+	inline void addGrad(BaseParamT<T>* replica) {
+		grad.vec() += replica->grad.vec();
+	}
+
+	// iter is kept by the replica
+	inline void shareState(BaseParamT<T>* master) {
+		ParamT* ptr = (ParamT*)master;
+		val.share(ptr->val);
+		aux_square.share(ptr->aux_square);
+		aux_mean.share(ptr->aux_mean);
+	}
+
 	inline void save(std::ofstream &os)const {
 		val.save(os);
 		aux_square.save(os);
@@ -98,6 +114,14 @@ struct Param : BaseParam {
 		aux_mean.load(is, mem);
 		is >> iter;
 	}
+
+	inline ParamBytes bytes() const {
+		ParamBytes res = BaseParamT<T>::bytes();
+		res.optimizer = aux_square.bytes() + aux_mean.bytes();
+		return res;
+	}
 };
 
+typedef ParamT<dtype> Param;
+
 #endif /* PARAM_H_ */
@@ -10,10 +10,14 @@ public:
 	vector<Tensor1D> masks; 
 	vector<PNode> ins;
 	int nSize;
+	int capacity;  //masks with their tensors allocated
+	AlignedMemoryPool* pool;
 
 public:
 	PoolNode() : Node(){
 		ins.clear();
+		capacity = 0;
+		pool = NULL;
 	}
 	
 	~PoolNode(){
@@ -32,11 +36,24 @@ public:
 	
 	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
 		Node::init(dim, -1, mem);
-		int count = masks.size();	
-		for(int idx = 0; idx < count; idx++){
+		pool = mem;
+		capacity = 0;
+	}		
+
+	//masks are allocated on demand, up to setParam(maxsize), see reserveNodes
+	inline bool reserve(int size){
+		return reserveNodes("pooling", size, masks.size(), capacity, pool, [&](int idx, AlignedMemoryPool* mem){
 			masks[idx].init(dim, mem);
+		});
+	}
+
+	inline size_t bytes() const {
+		size_t total = Node::bytes();
+		for (int idx = 0; idx < masks.size(); idx++){
+			total += masks[idx].bytes();
 		}
-	}		
+		return total;
+	}
 
 public:
 
@@ -73,6 +90,7 @@ public:
 			return;
 		}
 		nSize = x.size();
+		if (!reserve(nSize)) return;
 		ins.clear();
 		for (int i = 0; i < nSize; i++){
 			ins.push_back(x[i]);
@@ -87,6 +105,10 @@ public:
 			masks[i].zero();
 		}
 
+		for (int i = 0; i < nSize; ++i){
+			ins[i]->increase_loc();
+		}
+
 		for (int idx = 0; idx < dim; idx++){
 			int maxIndex = -1;
 			for (int i = 0; i < nSize; ++i){
@@ -102,10 +124,6 @@ public:
 			val.vec() += masks[i].vec() * ins[i]->val.vec();
 		}
 
-		for (int i = 0; i < nSize; ++i){
-			ins[i]->increase_loc();
-		}
-
 		cg->addNode(this);
 	}
 
@@ -127,6 +145,7 @@ public:
 		}
 
 		nSize = x.size();
+		if (!reserve(nSize)) return;
 		ins.clear();
 		for (int i = 0; i < nSize; i++){
 			ins.push_back(x[i]);
@@ -141,13 +160,13 @@ public:
 			masks[i] = 1.0;
 		}
 
-		val.zero();
 		for (int i = 0; i < nSize; ++i){
-			val.vec() += masks[i].vec() * ins[i]->val.vec();
+			ins[i]->increase_loc();
 		}
 
+		val.zero();
 		for (int i = 0; i < nSize; ++i){
-			ins[i]->increase_loc();
+			val.vec() += masks[i].vec() * ins[i]->val.vec();
 		}
 
 		cg->addNode(this);
@@ -170,6 +189,7 @@ public:
 			return;
 		}
 		nSize = x.size();
+		if (!reserve(nSize)) return;
 		ins.clear();
 		for (int i = 0; i < nSize; i++){
 			ins.push_back(x[i]);
@@ -185,6 +205,10 @@ public:
 		}
 
 
+		for (int i = 0; i < nSize; ++i){
+			ins[i]->increase_loc();
+		}
+
 		for (int idx = 0; idx < dim; idx++){
 			int minIndex = -1;
 			for (int i = 0; i < nSize; ++i){
@@ -200,10 +224,6 @@ public:
 			val.vec() += masks[i].vec() * ins[i]->val.vec();
 		}
 
-		for (int i = 0; i < nSize; ++i){
-			ins[i]->increase_loc();
-		}
-
 		cg->addNode(this);
 	}
 
@@ -224,6 +244,7 @@ public:
 		}
 
 		nSize = x.size();
+		if (!reserve(nSize)) return;
 		ins.clear();
 		for (int i = 0; i < nSize; i++){
 			ins.push_back(x[i]);
@@ -237,6 +258,10 @@ public:
 			}
 		}
 
+		for (int i = 0; i < nSize; ++i){
+			ins[i]->increase_loc();
+		}
+
 		val.zero();
 		for (int i = 0; i < nSize; ++i){
 			val.vec() += ins[i]->val.vec() * ins[i]->val.vec();
@@ -247,10 +272,6 @@ public:
 			masks[i].vec() = ins[i]->val.vec() / val.vec();
 		}
 
-		for (int i = 0; i < nSize; ++i){
-			ins[i]->increase_loc();
-		}
-
 		cg->addNode(this);
 	}
 
@@ -272,6 +293,7 @@ public:
 		}
 
 		nSize = x.size();
+		if (!reserve(nSize)) return;
 		ins.clear();
 		for (int i = 0; i < nSize; i++){
 			ins.push_back(x[i]);
@@ -286,13 +308,13 @@ public:
 			masks[i] = 1.0 / nSize;
 		}
 
-		val.zero();
 		for (int i = 0; i < nSize; ++i){
-			val.vec() += masks[i].vec() * ins[i]->val.vec();
+			ins[i]->increase_loc();
 		}
 
+		val.zero();
 		for (int i = 0; i < nSize; ++i){
-			ins[i]->increase_loc();
+			val.vec() += masks[i].vec() * ins[i]->val.vec();
 		}
 
 		cg->addNode(this);
@@ -0,0 +1,310 @@
+#ifndef N3L_PROFILER_H
+#define N3L_PROFILER_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <typeinfo>
+#include <typeindex>
+#include <sstream>
+#ifdef __GNUC__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+#include "Node.h"
+
+using namespace std;
+
+struct ProfileStat {
+	string name;
+	long fwd_calls, bwd_calls;
+	double fwd_time, bwd_time;  //in microseconds
+	double flops;  //forward flops, backward is about twice of them
+
+	ProfileStat(){
+		fwd_calls = bwd_calls = 0;
+		fwd_time = bwd_time = 0.0;
+		flops = 0.0;
+	}
+
+	inline double total() const {
+		return fwd_time + bwd_time;
+	}
+};
+
+struct TraceEvent {
+	string name;
+	const char* cat;
+	double ts, dur;
+};
+
+// an opt-in profiler of the forward and backward of a graph, enable it by graph.profiler = &profiler.
+// statistics are kept per node type and per param set (the paramKey of a node).
+// the forward of a node is timed from the previous addNode to its own addNode,
+// so do build the graph without unrelated work in between when profiling.
+// the loss functions report themselves by a ProfileScope through the profiler of the current thread.
+class Profiler {
+public:
+	map<std::type_index, ProfileStat> types;
+	map<const void*, ProfileStat> params;
+	map<const void*, string> names;  //names of param sets, the address is used otherwise
+	vector<TraceEvent> events;
+	bool trace;  //keep the events for exportTrace
+	int max_events;
+	int tid;  //thread id in the trace
+	int epoch;
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point origin, last;
+	double batch_time;  //the time of a batch, shared by its nodes
+	int batch_left;
+
+public:
+	Profiler(){
+		trace = false;
+		max_events = 1000000;
+		tid = 0;
+		epoch = 0;
+		origin = last = Clock::now();
+		batch_time = 0.0;
+		batch_left = 0;
+	}
+
+	// the profiler of the graph being run by this thread, used by the loss functions
+	static inline Profiler*& current(){
+		static thread_local Profiler* profiler = NULL;
+		return profiler;
+	}
+
+public:
+	inline void nameParam(const void* key, const string& name){
+		names[key] = name;
+	}
+
+	inline double now() const {
+		return std::chrono::duration<double, std::micro>(Clock::now() - origin).count();
+	}
+
+	//restart the forward timing, e.g., when a new graph begins
+	inline void lap(){
+		last = Clock::now();
+	}
+
+	inline double elapsed(){
+		Clock::time_point cur = Clock::now();
+		double t = std::chrono::duration<double, std::micro>(cur - last).count();
+		last = cur;
+		return t;
+	}
+
+	//the next count forward calls share the time since the last call
+	inline void shareForward(int count){
+		batch_time = elapsed();
+		batch_left = count;
+	}
+
+	template<typename T>
+	inline void forward(NodeT<T>* x){
+		double t;
+		if (batch_left > 0){
+			t = batch_time / batch_left;
+			batch_time -= t;
+			batch_left--;
+			lap();
+		}
+		else{
+			t = elapsed();
+		}
+		double f = x->flops();
+		ProfileStat& stat = typeStat(x);
+		stat.fwd_calls++; stat.fwd_time += t; stat.flops += f;
+		const void* key = x->paramKey();
+		if (key != NULL){
+			ProfileStat& pstat = paramStat(key);
+			pstat.fwd_calls++; pstat.fwd_time += t; pstat.flops += f;
+		}
+		if (trace) record(stat.name, "forward", t);
+	}
+
+	template<typename T>
+	inline void backward(NodeT<T>* x, double t){
+		ProfileStat& stat = typeStat(x);
+		stat.bwd_calls++; stat.bwd_time += t;
+		const void* key = x->paramKey();
+		if (key != NULL){
+			ProfileStat& pstat = paramStat(key);
+			pstat.bwd_calls++; pstat.bwd_time += t;
+		}
+		if (trace) record(stat.name, "backward", t);
+	}
+
+	template<typename T>
+	inline void backward(const vector<NodeT<T>*>& batch, double t){
+		int count = batch.size();
+		for (int idx = 0; idx < count; idx++){
+			backward(batch[idx], t / count);
+		}
+	}
+
+	//time of code outside the graph, e.g., the loss functions
+	inline void scope(const string& name, double t, double f){
+		ProfileStat& stat = scopeStat(name);
+		stat.fwd_calls++; stat.fwd_time += t; stat.flops += f;
+		if (trace) record(name, "loss", t);
+	}
+
+	inline void reset(){
+		types.clear();
+		params.clear();
+		scopes.clear();
+		events.clear();
+		lap();
+	}
+
+	// aggregates of the epoch, sorted by the total time, then reset for the next epoch
+	inline void report(std::ostream& os = std::cout){
+		os << "profile of epoch " << epoch << std::endl;
+		vector<ProfileStat> stats;
+		for (map<std::type_index, ProfileStat>::iterator it = types.begin(); it != types.end(); it++) stats.push_back(it->second);
+		for (map<string, ProfileStat>::iterator it = scopes.begin(); it != scopes.end(); it++) stats.push_back(it->second);
+		print(os, "node type", stats);
+		stats.clear();
+		for (map<const void*, ProfileStat>::iterator it = params.begin(); it != params.end(); it++) stats.push_back(it->second);
+		print(os, "param set", stats);
+	}
+
+	inline void endEpoch(std::ostream& os = std::cout){
+		report(os);
+		reset();
+		epoch++;
+	}
+
+	// chrome://tracing (or perfetto) format, the events are laid out back to back on one thread,
+	// all events are kept from the last reset
+	inline void exportTrace(const string& file){
+		std::ofstream os(file.c_str());
+		if (!os.is_open()){
+			std::cout << "profiler error: can not open " << file << std::endl;
+			return;
+		}
+		os << "{\"traceEvents\":[";
+		os << std::fixed << std::setprecision(3);
+		for (int idx = 0; idx < events.size(); idx++){
+			const TraceEvent& e = events[idx];
+			if (idx > 0) os << ",";
+			os << "\n{\"name\":\"" << json_escape(e.name) << "\",\"cat\":\"" << e.cat << "\",\"ph\":\"X\",\"ts\":" << e.ts
+				<< ",\"dur\":" << e.dur << ",\"pid\":0,\"tid\":" << tid << "}";
+		}
+		os << "\n]}" << std::endl;
+		os.close();
+	}
+
+protected:
+	map<string, ProfileStat> scopes;
+
+	template<typename T>
+	inline ProfileStat& typeStat(NodeT<T>* x){
+		std::type_index type = std::type_index(typeid(*x));
+		map<std::type_index, ProfileStat>::iterator it = types.find(type);
+		if (it != types.end()) return it->second;
+		ProfileStat& stat = types[type];
+		stat.name = demangle(typeid(*x).name());
+		return stat;
+	}
+
+	inline ProfileStat& paramStat(const void* key){
+		map<const void*, ProfileStat>::iterator it = params.find(key);
+		if (it != params.end()) return it->second;
+		ProfileStat& stat = params[key];
+		map<const void*, string>::iterator name = names.find(key);
+		if (name != names.end()){
+			stat.name = name->second;
+		}
+		else{
+			std::ostringstream os;
+			os << key;
+			stat.name = os.str();
+		}
+		return stat;
+	}
+
+	inline ProfileStat& scopeStat(const string& name){
+		ProfileStat& stat = scopes[name];
+		stat.name = name;
+		return stat;
+	}
+
+	//events end now and lasted t
+	inline void record(const string& name, const char* cat, double t){
+		if (events.size() >= max_events) return;
+		TraceEvent e;
+		e.name = name;
+		e.cat = cat;
+		e.dur = t;
+		e.ts = now() - t;
+		events.push_back(e);
+	}
+
+	static inline string demangle(const char* name){
+#ifdef __GNUC__
+		int status = 0;
+		char* real = abi::__cxa_demangle(name, NULL, NULL, &status);
+		if (status == 0 && real != NULL){
+			string result(real);
+			free(real);
+			return result;
+		}
+#endif
+		return string(name);
+	}
+
+	inline void print(std::ostream& os, const string& title, vector<ProfileStat>& stats){
+		sort(stats.begin(), stats.end(), [](const ProfileStat& a, const ProfileStat& b){ return a.total() > b.total(); });
+		double sum = 0.0;
+		for (int idx = 0; idx < stats.size(); idx++) sum += stats[idx].total();
+		os << std::left << std::setw(28) << title << std::right
+			<< std::setw(10) << "fwd calls" << std::setw(12) << "fwd ms"
+			<< std::setw(10) << "bwd calls" << std::setw(12) << "bwd ms"
+			<< std::setw(8) << "%" << std::setw(12) << "GFLOP/s" << std::endl;
+		os << std::fixed << std::setprecision(3);
+		for (int idx = 0; idx < stats.size(); idx++){
+			const ProfileStat& s = stats[idx];
+			double gflops = s.fwd_time > 0 ? s.flops / s.fwd_time / 1000.0 : 0.0;
+			os << std::left << std::setw(28) << s.name.substr(0, 27) << std::right
+				<< std::setw(10) << s.fwd_calls << std::setw(12) << s.fwd_time / 1000.0
+				<< std::setw(10) << s.bwd_calls << std::setw(12) << s.bwd_time / 1000.0
+				<< std::setw(8) << (sum > 0 ? 100.0 * s.total() / sum : 0.0) << std::setw(12) << gflops << std::endl;
+		}
+		os.unsetf(std::ios_base::floatfield);
+	}
+};
+
+// times a block of code outside the graph into the profiler of the current thread, if any
+struct ProfileScope {
+	Profiler* profiler;
+	const char* name;
+	double flops;
+	double start;
+
+	ProfileScope(const char* scopeName, double scopeFlops = 0.0){
+		profiler = Profiler::current();
+		if (profiler == NULL) return;
+		name = scopeName;
+		flops = scopeFlops;
+		start = profiler->now();
+	}
+
+	~ProfileScope(){
+		if (profiler == NULL) return;
+		profiler->scope(name, profiler->now() - start, flops);
+		profiler->lap();
+	}
+};
+
+#endif
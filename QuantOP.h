@@ -0,0 +1,433 @@
+#ifndef N3L_QUANTOP_H
+#define N3L_QUANTOP_H
+
+#include "QuantParam.h"
+#include "UniOP.h"
+#include "BiOP.h"
+#include "TriOP.h"
+
+// int8 copies of UniParams, BiParams and TriParams, with nodes for inference in place of UniNode, BiNode and TriNode.
+// the biases stay in dtype. the nodes compute forward only, and backward does nothing.
+//	QuantBiParams gate;
+//	gate.quantize(model.gate);
+//	QuantBiNode node;
+//	node.setParam(&gate);
+//	node.setFunctions(fsigmoid);
+//	node.init(gate.W1.outDim(), -1);
+struct QuantUniParams {
+public:
+	QuantParam W;
+	Tensor1D b;
+	bool bUseB;
+
+public:
+	QuantUniParams() {
+		bUseB = true;
+	}
+
+	inline void quantize(const UniParams& param, AlignedMemoryPool* mem = NULL) {
+		bUseB = param.bUseB;
+		W.quantize(param.W, mem);
+		if (bUseB) {
+			b.init(param.b.val.size, mem);
+			b.mat() = param.b.val.mat();
+		}
+	}
+
+	inline size_t bytes() const {
+		return W.bytes() + b.bytes();
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << bUseB << std::endl;
+		W.save(os);
+		if (bUseB) {
+			b.save(os);
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W.load(is, mem);
+		if (bUseB) {
+			b.load(is, mem);
+		}
+	}
+};
+
+struct QuantBiParams {
+public:
+	QuantParam W1;
+	QuantParam W2;
+	Tensor1D b;
+	bool bUseB;
+
+public:
+	QuantBiParams() {
+		bUseB = true;
+	}
+
+	inline void quantize(const BiParams& param, AlignedMemoryPool* mem = NULL) {
+		bUseB = param.bUseB;
+		W1.quantize(param.W1, mem);
+		W2.quantize(param.W2, mem);
+		if (bUseB) {
+			b.init(param.b.val.size, mem);
+			b.mat() = param.b.val.mat();
+		}
+	}
+
+	inline size_t bytes() const {
+		return W1.bytes() + W2.bytes() + b.bytes();
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << bUseB << std::endl;
+		W1.save(os);
+		W2.save(os);
+		if (bUseB) {
+			b.save(os);
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W1.load(is, mem);
+		W2.load(is, mem);
+		if (bUseB) {
+			b.load(is, mem);
+		}
+	}
+};
+
+struct QuantTriParams {
+public:
+	QuantParam W1;
+	QuantParam W2;
+	QuantParam W3;
+	Tensor1D b;
+	bool bUseB;
+
+public:
+	QuantTriParams() {
+		bUseB = true;
+	}
+
+	inline void quantize(const TriParams& param, AlignedMemoryPool* mem = NULL) {
+		bUseB = param.bUseB;
+		W1.quantize(param.W1, mem);
+		W2.quantize(param.W2, mem);
+		W3.quantize(param.W3, mem);
+		if (bUseB) {
+			b.init(param.b.val.size, mem);
+			b.mat() = param.b.val.mat();
+		}
+	}
+
+	inline size_t bytes() const {
+		return W1.bytes() + W2.bytes() + W3.bytes() + b.bytes();
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << bUseB << std::endl;
+		W1.save(os);
+		W2.save(os);
+		W3.save(os);
+		if (bUseB) {
+			b.save(os);
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		is >> bUseB;
+		W1.load(is, mem);
+		W2.load(is, mem);
+		W3.load(is, mem);
+		if (bUseB) {
+			b.load(is, mem);
+		}
+	}
+};
+
+
+struct QuantUniNode : Node {
+public:
+	PNode in;
+	Tensor1D ty;
+	QuantUniParams* param;
+
+	dtype (*activate)(const dtype&);   // activation function
+
+public:
+	QuantUniNode() : Node() {
+		in = NULL;
+		activate = ftanh;
+		param = NULL;
+	}
+
+	inline void setParam(QuantUniParams* paramInit) {
+		param = paramInit;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&)) {
+		activate = f;
+	}
+
+	inline double flops() const {
+		return 2.0 * param->W.inDim() * dim;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		in = NULL;
+		ty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes();
+	}
+
+public:
+	void forward(Graph *cg, PNode x) {
+		in = x;
+		cg->require(in);
+		in->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.zero();
+		param->W.multiply(in->val, ty);
+		if (param->bUseB) {
+			ty.vec() += param->b.vec();
+		}
+		activate_forward(activate, ty, val);
+	}
+};
+
+struct QuantBiNode : Node {
+public:
+	PNode in1, in2;
+	Tensor1D ty;
+	QuantBiParams* param;
+
+	dtype (*activate)(const dtype&);   // activation function
+
+public:
+	QuantBiNode() : Node() {
+		in1 = in2 = NULL;
+		activate = ftanh;
+		param = NULL;
+	}
+
+	inline void setParam(QuantBiParams* paramInit) {
+		param = paramInit;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&)) {
+		activate = f;
+	}
+
+	inline double flops() const {
+		return 2.0 * (param->W1.inDim() + param->W2.inDim()) * dim;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		in1 = in2 = NULL;
+		ty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes();
+	}
+
+public:
+	void forward(Graph *cg, PNode x1, PNode x2) {
+		in1 = x1;
+		in2 = x2;
+		cg->require(in1);
+		cg->require(in2);
+		in1->increase_loc();
+		in2->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.zero();
+		param->W1.multiply(in1->val, ty);
+		param->W2.multiply(in2->val, ty);
+		if (param->bUseB) {
+			ty.vec() += param->b.vec();
+		}
+		activate_forward(activate, ty, val);
+	}
+};
+
+struct QuantTriNode : Node {
+public:
+	PNode in1, in2, in3;
+	Tensor1D ty;
+	QuantTriParams* param;
+
+	dtype (*activate)(const dtype&);   // activation function
+
+public:
+	QuantTriNode() : Node() {
+		in1 = in2 = in3 = NULL;
+		activate = ftanh;
+		param = NULL;
+	}
+
+	inline void setParam(QuantTriParams* paramInit) {
+		param = paramInit;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&)) {
+		activate = f;
+	}
+
+	inline double flops() const {
+		return 2.0 * (param->W1.inDim() + param->W2.inDim() + param->W3.inDim()) * dim;
+	}
+
+	inline void clearValue(){
+		Node::clearValue();
+		in1 = in2 = in3 = NULL;
+		ty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes();
+	}
+
+public:
+	void forward(Graph *cg, PNode x1, PNode x2, PNode x3) {
+		in1 = x1;
+		in2 = x2;
+		in3 = x3;
+		cg->require(in1);
+		cg->require(in2);
+		cg->require(in3);
+		in1->increase_loc();
+		in2->increase_loc();
+		in3->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.zero();
+		param->W1.multiply(in1->val, ty);
+		param->W2.multiply(in2->val, ty);
+		param->W3.multiply(in3->val, ty);
+		if (param->bUseB) {
+			ty.vec() += param->b.vec();
+		}
+		activate_forward(activate, ty, val);
+	}
+};
+
+
+// accuracy of a quantized model against the float one, like CheckGrad.
+// after both models are run on an example, add() compares their nodes of the same name,
+// and report() prints the errors over all the examples so far.
+//	QuantCheck check;
+//	for (...) { ... check.add("output", float_model._output, quant_model._output); }
+//	check.report("dev");
+class QuantCheck {
+public:
+	vector<string> _names;
+	vector<int> _counts;
+	vector<double> _maxErrors, _sumErrors, _sumCosines;
+	vector<int> _argmaxAgreed;
+
+public:
+	inline void clear(){
+		_names.clear();
+		_counts.clear();
+		_maxErrors.clear();
+		_sumErrors.clear();
+		_sumCosines.clear();
+		_argmaxAgreed.clear();
+	}
+
+	inline void add(const string& name, const Node& ref, const Node& quant){
+		int id = std::find(_names.begin(), _names.end(), name) - _names.begin();
+		if (id == _names.size()) {
+			_names.push_back(name);
+			_counts.push_back(0);
+			_maxErrors.push_back(0);
+			_sumErrors.push_back(0);
+			_sumCosines.push_back(0);
+			_argmaxAgreed.push_back(0);
+		}
+		if (ref.dim != quant.dim) {
+			std::cout << "quant check error: dims of " << name << " do not match" << std::endl;
+			return;
+		}
+		double maxError = 0, sumError = 0, dot = 0, refNorm = 0, quantNorm = 0;
+		int refMax = 0, quantMax = 0;
+		for (int idx = 0; idx < ref.dim; idx++) {
+			double error = fabs(ref.val[idx] - quant.val[idx]);
+			if (error > maxError) maxError = error;
+			sumError += error;
+			dot += ref.val[idx] * quant.val[idx];
+			refNorm += ref.val[idx] * ref.val[idx];
+			quantNorm += quant.val[idx] * quant.val[idx];
+			if (ref.val[idx] > ref.val[refMax]) refMax = idx;
+			if (quant.val[idx] > quant.val[quantMax]) quantMax = idx;
+		}
+		_counts[id]++;
+		if (maxError > _maxErrors[id]) _maxErrors[id] = maxError;
+		_sumErrors[id] += ref.dim > 0 ? sumError / ref.dim : 0;
+		_sumCosines[id] += (refNorm > 0 && quantNorm > 0) ? dot / sqrt(refNorm * quantNorm) : 1;
+		if (refMax == quantMax) _argmaxAgreed[id]++;
+	}
+
+	inline void report(const string& description) const {
+		for (int idx = 0; idx < _names.size(); idx++) {
+			int count = _counts[idx] > 0 ? _counts[idx] : 1;
+			printf("%s, Checking quantization for %s over %d:\t", description.c_str(), _names[idx].c_str(), _counts[idx]);
+			printf("max error = %.8f, mean error = %.8f, mean cosine = %.8f, argmax agreed = %.4f\n",
+				_maxErrors[idx], _sumErrors[idx] / count, _sumCosines[idx] / count, _argmaxAgreed[idx] * 1.0 / count);
+		}
+	}
+};
+
+#endif
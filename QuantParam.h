@@ -0,0 +1,160 @@
+#ifndef N3L_QUANTPARAM_H
+#define N3L_QUANTPARAM_H
+
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "MyTensor.h"
+#include "BaseParam.h"
+#include "ScratchArena.h"
+
+// int8 post-training quantization of frozen weights, for inference only.
+// each row of W (one output) has its own scale, the input vector is quantized with one scale when multiplied,
+// and the products are accumulated in int32: by VNNI (dpbusd) or AVX2 (maddubs) when the compiler targets them, e.g., -march=native.
+// values are clamped to [-127, 127], so the sign trick of the unsigned x signed instructions never overflows.
+
+// dot product of n int8 values
+inline int quant_dot(const signed char* w, const signed char* x, int n) {
+	int idx = 0, sum = 0;
+#if defined(__AVX2__)
+	__m256i acc = _mm256_setzero_si256();
+#if !defined(__AVXVNNI__) && !(defined(__AVX512VNNI__) && defined(__AVX512VL__))
+	const __m256i ones = _mm256_set1_epi16(1);
+#endif
+	for (; idx + 32 <= n; idx += 32) {
+		__m256i vx = _mm256_loadu_si256((const __m256i*)(x + idx));
+		__m256i vw = _mm256_loadu_si256((const __m256i*)(w + idx));
+		__m256i ux = _mm256_sign_epi8(vx, vx);  // |x|
+		__m256i sw = _mm256_sign_epi8(vw, vx);  // w with the sign of x
+#if defined(__AVXVNNI__)
+		acc = _mm256_dpbusd_avx_epi32(acc, ux, sw);
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+		acc = _mm256_dpbusd_epi32(acc, ux, sw);
+#else
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(ux, sw), ones));
+#endif
+	}
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(half);
+#endif
+	for (; idx < n; idx++) {
+		sum += (int)w[idx] * (int)x[idx];
+	}
+	return sum;
+}
+
+// scale of n values of x so that the largest one maps to 127, and the int8 values into q
+template<typename T>
+inline float quant_values(const T* x, int n, signed char* q) {
+	float maxValue = 0;
+	for (int idx = 0; idx < n; idx++) {
+		float cur = fabs((float)x[idx]);
+		if (cur > maxValue) maxValue = cur;
+	}
+	float scale = maxValue > 0 ? maxValue / 127 : 1;
+	for (int idx = 0; idx < n; idx++) {
+		int cur = (int)lrintf((float)x[idx] / scale);
+		q[idx] = (signed char)(cur > 127 ? 127 : (cur < -127 ? -127 : cur));
+	}
+	return scale;
+}
+
+// the frozen W of a Param quantized by rows.
+// the rows are stored one after another and padded to 32 int8 values, by a column major tensor of the transposed shape,
+// so the kernel reads each row successively.
+struct QuantParam {
+public:
+	Tensor2DT<signed char> val;  //row = padded input dim, col = output dim
+	Tensor1DT<float> scale;  //of each output
+	int nOSize, nISize;
+
+public:
+	QuantParam() {
+		nOSize = nISize = 0;
+	}
+
+	inline int outDim() const {
+		return nOSize;
+	}
+
+	inline int inDim() const {
+		return nISize;
+	}
+
+	inline size_t bytes() const {
+		return val.bytes() + scale.bytes();
+	}
+
+	static inline int padded(int dim) {
+		return (dim + 31) / 32 * 32;
+	}
+
+	inline void allocate(int outDim, int inDim, AlignedMemoryPool* mem = NULL) {
+		nOSize = outDim;
+		nISize = inDim;
+		val.init(padded(inDim), outDim, mem);
+		scale.init(outDim, mem);
+	}
+
+	inline void quantize(const BaseParam& param, AlignedMemoryPool* mem = NULL) {
+		allocate(param.val.row, param.val.col, mem);
+		vector<dtype> row(nISize);
+		for (int idx = 0; idx < nOSize; idx++) {
+			for (int idy = 0; idy < nISize; idy++) {
+				row[idy] = param.val[idy][idx];
+			}
+			scale[idx] = quant_values(row.data(), nISize, val[idx]);
+		}
+	}
+
+	//y += W x, x is quantized with one scale
+	inline void multiply(const Tensor1D& x, Tensor1D& y) const {
+		if (x.dim != nISize || y.dim != nOSize) {
+			std::cout << "warning: quantized param dims do not match." << std::endl;
+		}
+		ScratchScope scope;
+		int dim = val.row;
+		ScratchVec<signed char> qx(dim);
+		for (int idx = nISize; idx < dim; idx++) qx[idx] = 0;
+		float xscale = quant_values(x.v, nISize, &qx[0]);
+		for (int idx = 0; idx < nOSize; idx++) {
+			y[idx] += (dtype)(scale[idx] * xscale) * quant_dot(val[idx], &qx[0], dim);
+		}
+	}
+
+	//the value of W[idx][idy] after quantization
+	inline dtype value(int idx, int idy) const {
+		return scale[idx] * val[idx][idy];
+	}
+
+	inline void save(std::ofstream &os) const {
+		os << nOSize << " " << nISize << std::endl;
+		for (int idx = 0; idx < nOSize; idx++) {
+			os << scale[idx];
+			for (int idy = 0; idy < nISize; idy++) {
+				os << " " << (int)val[idx][idy];
+			}
+			os << std::endl;
+		}
+	}
+
+	inline void load(std::ifstream &is, AlignedMemoryPool* mem = NULL) {
+		int curOSize, curISize, cur;
+		is >> curOSize >> curISize;
+		allocate(curOSize, curISize, mem);
+		for (int idx = 0; idx < nOSize; idx++) {
+			is >> scale[idx];
+			for (int idy = 0; idy < nISize; idy++) {
+				is >> cur;
+				val[idx][idy] = (signed char)cur;
+			}
+		}
+	}
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "BiOP.h"
 #include "Graph.h"
+#include "SeqProj.h"
 
 struct RNNParams {
 	BiParams _rnn;
@@ -35,12 +36,17 @@ public:
 	int _outDim;
 
 	Node _bucket;
-	vector<BiNode> _output;
+	vector<SeqStepNode> _output;
+	SeqProjNode _proj;  //W2 of all the inputs, before the steps
 	
 	RNNParams* _params;
 	
 	bool _left2right;
 
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+	dtype _dropout;
+
 public:
 	~RNNBuilder() {
 		clear();
@@ -57,14 +63,30 @@ public:
 		_outDim = _params->_rnn.W2.outDim();
 		int maxsize = _output.size();
 		for (int idx = 0; idx < maxsize; idx++){
-			_output[idx].setParam(&_params->_rnn);
+			_output[idx].setParam(&_params->_rnn.W1, NULL, _params->_rnn.bUseB ? &_params->_rnn.b : NULL);
 			_output[idx].setFunctions(&ftanh, &dtanh);
-			_output[idx].init(_outDim, dropout, mem);
 		}
+		_proj.init(&_params->_rnn.W2, 0, _inDim, maxsize, mem);
 		_left2right = left2right;
+		_capacity = 0;
+		_mem = mem;
+		_dropout = dropout;
 		_bucket.init(_outDim, -1, mem);
 		_bucket.set_bucket();
 	}
+
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		if (!reserveNodes("RNN", size, _output.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
+			_output[idx].init(_outDim, _dropout, mem);
+		})) return false;
+		_proj.reserve(_capacity);
+		return true;
+	}
+
+	inline size_t bytes() const {
+		return _bucket.bytes() + nodeBytes(_output) + _proj.bytes();
+	}
 	
 	inline void resize(int maxsize){
 		_output.resize(maxsize);
@@ -78,6 +100,9 @@ public:
 		_outDim = 0;
 		_left2right = true;	
 		_params = NULL;
+		_capacity = 0;
+		_mem = NULL;
+		_dropout = -1;
 	}	
 	
 	inline void forward(Graph *cg, const vector<PNode>& x) {
@@ -90,6 +115,8 @@ public:
 			std::cout << "input dim dose not match for seg operation" << std::endl;
 			return;
 		}
+		if (!reserve(_nSize)) return;
+		_proj.forward(cg, x);
 		if (_left2right)
 			left2right_forward(cg, x);
 		else
@@ -100,17 +127,17 @@ protected:
 	inline void left2right_forward(Graph *cg, const vector<PNode>& x) {
 		for (int idx = 0; idx < _nSize; idx++) {
 			if (idx == 0)
-				_output[idx].forward(cg, &_bucket, x[idx]);
+				_output[idx].forward(cg, &_bucket, NULL, &_proj, idx);
 			else
-				_output[idx].forward(cg, &_output[idx - 1], x[idx]);
+				_output[idx].forward(cg, &_output[idx - 1], NULL, &_proj, idx);
 		}
 	}
 	inline void right2left_forward(Graph *cg, const vector<PNode>& x) {
 		for (int idx = _nSize - 1; idx >= 0; idx--) {
 			if (idx == _nSize - 1)
-				_output[idx].forward(cg, &_bucket, x[idx]);
+				_output[idx].forward(cg, &_bucket, NULL, &_proj, idx);
 			else
-				_output[idx].forward(cg, &_output[idx + 1], x[idx]);
+				_output[idx].forward(cg, &_output[idx + 1], NULL, &_proj, idx);
 		}
 	}
 };
@@ -148,6 +175,10 @@ public:
 		_bucket.init(_outDim, -1, mem);
 		_bucket.set_bucket();
 	}
+
+	inline size_t bytes() const {
+		return _bucket.bytes() + _output.bytes();
+	}
 	
 	inline void clear() {	
 		_nSize = 0;
@@ -0,0 +1,191 @@
+#ifndef N3L_SCRATCHARENA_H
+#define N3L_SCRATCHARENA_H
+
+#include <vector>
+#include <algorithm>
+#include "Mem.h"
+
+// a stack of the temporaries of one example, e.g., the tables of the crf losses.
+// memory is bumped from blocks kept over examples, and given back by rewind to a mark,
+// so once the blocks are large enough, no heap allocation is done per example.
+// there is one arena per thread, see local(); Graph::clearValue resets it.
+class ScratchArena {
+public:
+	struct Mark {
+		int block;
+		size_t offset;
+	};
+
+protected:
+	const static int align = 32;
+	std::vector<char*> blocks;
+	std::vector<size_t> sizes;
+	size_t block_size;
+	int block;  //the current block and the offset in it
+	size_t offset;
+
+public:
+	ScratchArena(size_t size = 1 << 20) {
+		block_size = size;
+		block = 0;
+		offset = 0;
+	}
+
+	~ScratchArena() {
+		for (int idx = 0; idx < blocks.size(); idx++) {
+			_mm_free(blocks[idx]);
+		}
+		blocks.clear();
+		sizes.clear();
+	}
+
+	static inline ScratchArena& local() {
+		static thread_local ScratchArena arena;
+		return arena;
+	}
+
+public:
+	inline void* allocate(size_t n) {
+		n = ((n + align - 1) / align) * align;
+		while (block < blocks.size()) {
+			if (offset + n <= sizes[block]) {
+				void* res = blocks[block] + offset;
+				offset += n;
+				return res;
+			}
+			block++;
+			offset = 0;
+		}
+		size_t size = std::max(n, block_size);
+		blocks.push_back((char*)_mm_malloc(size, align));
+		sizes.push_back(size);
+		block = blocks.size() - 1;
+		offset = n;
+		return blocks[block];
+	}
+
+	inline Mark mark() const {
+		Mark m;
+		m.block = block;
+		m.offset = offset;
+		return m;
+	}
+
+	inline void rewind(const Mark& m) {
+		block = m.block;
+		offset = m.offset;
+	}
+
+	inline void reset() {
+		block = 0;
+		offset = 0;
+	}
+};
+
+// gives back everything allocated in its lifetime
+struct ScratchScope {
+	ScratchArena& arena;
+	ScratchArena::Mark start;
+
+	ScratchScope() : arena(ScratchArena::local()) {
+		start = arena.mark();
+	}
+
+	~ScratchScope() {
+		arena.rewind(start);
+	}
+};
+
+// matrices of plain values on the scratch arena of this thread, valid within the current ScratchScope.
+// the subscripts are those of NRMat and NRMat3d.
+template<typename T>
+class ScratchMat {
+protected:
+	T* v;
+	int nn, mm;
+
+public:
+	ScratchMat(int n, int m) {
+		nn = n;
+		mm = m;
+		v = (T*)ScratchArena::local().allocate(sizeof(T) * n * m);
+	}
+
+	ScratchMat(T* p, int n, int m) {
+		v = p;
+		nn = n;
+		mm = m;
+	}
+
+	inline T* operator[](const int i) {
+		return v + i * mm;
+	}
+
+	inline const T* operator[](const int i) const {
+		return v + i * mm;
+	}
+
+	inline ScratchMat& operator=(const T& a) {
+		std::fill(v, v + nn * mm, a);
+		return *this;
+	}
+
+	inline int nrows() const {
+		return nn;
+	}
+
+	inline int ncols() const {
+		return mm;
+	}
+};
+
+template<typename T>
+class ScratchMat3d {
+protected:
+	T* v;
+	int nn, mm, kk;
+
+public:
+	ScratchMat3d(int n, int m, int k) {
+		nn = n;
+		mm = m;
+		kk = k;
+		v = (T*)ScratchArena::local().allocate(sizeof(T) * n * m * k);
+	}
+
+	inline ScratchMat<T> operator[](const int i) {
+		return ScratchMat<T>(v + i * mm * kk, mm, kk);
+	}
+
+	inline ScratchMat3d& operator=(const T& a) {
+		std::fill(v, v + nn * mm * kk, a);
+		return *this;
+	}
+};
+
+template<typename T>
+class ScratchVec {
+protected:
+	T* v;
+	int nn;
+
+public:
+	ScratchVec(int n) {
+		nn = n;
+		v = (T*)ScratchArena::local().allocate(sizeof(T) * n);
+	}
+
+	inline T& operator[](const int i) {
+		return v[i];
+	}
+
+	inline const T& operator[](const int i) const {
+		return v[i];
+	}
+
+	inline int size() const {
+		return nn;
+	}
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include "MyLib.h"
 #include "Metric.h"
 #include "Node.h"
+#include "Profiler.h"
+#include "ScratchArena.h"
 #include "Param.h"
 
 using namespace Eigen;
@@ -11,7 +13,7 @@ using namespace Eigen;
 struct Semi0CRFMLLoss{
 public:
 	int labelSize;
-	vector<dtype> buffer;
+	vector<ltype> buffer;
 	dtype eps;
 	vector<int> maxLens;
 	int maxLen;
@@ -46,7 +48,10 @@ public:
 
 public:
 	// 
-	inline dtype loss(const NRMat<PNode>& x, const vector<vector<vector<dtype> > >& answer, Metric& eval, int batchsize = 1){
+	template<typename S>
+	inline dtype loss(const NRMat<NodeT<S>*>& x, const vector<vector<vector<dtype> > >& answer, Metric& eval, int batchsize = 1){
+		ProfileScope scope("Semi0CRFMLLoss::loss", 4.0 * x.nrows() * x.ncols() * labelSize);
+		ScratchScope scratch;
 		/*
 		assert(x.nrows() > 0 && x.ncols() == x.nrows() && x.nrows() == answer.size() && x.nrows() == answer[0].size());
 		int nDim = x[0][0]->dim;
@@ -56,6 +61,7 @@ public:
 		}*/
 
 		int seq_size = x.nrows();
+		settle(x);
 		//int maxLength = x.ncols();
 
 		for (int idx = 0; idx < seq_size; idx++) {
@@ -66,8 +72,8 @@ public:
 
 
 		// comute alpha values, only the above parts are valid
-		NRMat3d<dtype> alpha(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> alpha_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha_answer(seq_size, maxLen, labelSize);
 		alpha = 0.0; alpha_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -106,7 +112,7 @@ public:
 				buffer.push_back(alpha[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ = logsumexp(buffer);
+		ltype logZ = logsumexp(buffer);
 
 		buffer.clear();
 		for (int j = 0; j < labelSize; ++j) {
@@ -114,13 +120,13 @@ public:
 				buffer.push_back(alpha_answer[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ_answer = logsumexp(buffer);
+		ltype logZ_answer = logsumexp(buffer);
 
-		dtype cost = (logZ - logZ_answer) / batchsize;
+		ltype cost = (logZ - logZ_answer) / batchsize;
 
 		// comute belta values
-		NRMat3d<dtype> belta(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> belta_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> belta(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> belta_answer(seq_size, maxLen, labelSize);
 		belta = 0.0; belta_answer = 0.0;
 		for (int idx = seq_size; idx > 0; idx--) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -151,8 +157,8 @@ public:
 		}
 
 		//compute margins
-		NRMat3d<dtype> margin(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> margin_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> margin(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> margin_answer(seq_size, maxLen, labelSize);
 		margin = 0.0; margin_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -182,7 +188,10 @@ public:
 	}
 
 	//viterbi decode algorithm
-	inline void predict(const NRMat<PNode>& x, NRMat<int>& y){
+	template<typename S>
+	inline void predict(const NRMat<NodeT<S>*>& x, NRMat<int>& y){
+		ProfileScope scope("Semi0CRFMLLoss::predict", 4.0 * x.nrows() * x.ncols() * labelSize);
+		ScratchScope scratch;
 		/*
 		assert(x.nrows() > 0 && x.ncols() == x.nrows());
 		int nDim = x[0][0]->dim;
@@ -192,11 +201,12 @@ public:
 		}*/
 
 		int seq_size = x.nrows();
+		settle(x);
 
-		NRMat3d<dtype> maxScores(seq_size, maxLen, labelSize);
-		NRMat3d<int> maxLastLabels(seq_size, maxLen, labelSize);
-		NRMat3d<int> maxLastStarts(seq_size, maxLen, labelSize);
-		NRMat3d<int> maxLastDists(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> maxScores(seq_size, maxLen, labelSize);
+		ScratchMat3d<int> maxLastLabels(seq_size, maxLen, labelSize);
+		ScratchMat3d<int> maxLastStarts(seq_size, maxLen, labelSize);
+		ScratchMat3d<int> maxLastDists(seq_size, maxLen, labelSize);
 
 		maxScores = 0.0; maxLastLabels = -2; 
 		maxLastStarts = -2; maxLastDists = -2;
@@ -214,10 +224,10 @@ public:
 						int maxLastLabel = -1;
 						int maxLastStart = -1;
 						int LastDist = -1;
-						dtype maxscore = 0.0;
+						ltype maxscore = 0.0;
 						for (int j = 0; j < labelSize; ++j) {
 							for (int prevdist = 1; prevdist <= idx && prevdist <= maxLens[j]; prevdist++) {
-								dtype curScore = maxScores[idx - prevdist][prevdist - 1][j];
+								ltype curScore = maxScores[idx - prevdist][prevdist - 1][j];
 								if (maxLastLabel == -1 || curScore > maxscore){
 									maxLastLabel = j;
 									maxLastStart = idx - prevdist;
@@ -239,13 +249,13 @@ public:
 		// below zero denotes no such segment
 		y.resize(seq_size, maxLen);
 		y = -1;
-		dtype maxFinalScore = 0.0;
+		ltype maxFinalScore = 0.0;
 		int maxFinalLabel = -1;
 		int maxFinalStart = -1;
 		int maxFinalDist = -1;
 		for (int j = 0; j < labelSize; ++j) {
 			for (int dist = 1; dist <= seq_size && dist <= maxLens[j]; dist++) {
-				dtype curScore = maxScores[seq_size - dist][dist - 1][j];
+				ltype curScore = maxScores[seq_size - dist][dist - 1][j];
 				if (maxFinalLabel == -1 || curScore > maxFinalScore){
 					maxFinalLabel = j;
 					maxFinalStart = seq_size - dist;
@@ -275,7 +285,10 @@ public:
 
 	}
 
-	inline dtype cost(const NRMat<PNode>& x, const vector<vector<vector<dtype> > >& answer, int batchsize = 1){
+	template<typename S>
+	inline ltype cost(const NRMat<NodeT<S>*>& x, const vector<vector<vector<dtype> > >& answer, int batchsize = 1){
+		ProfileScope scope("Semi0CRFMLLoss::cost", 4.0 * x.nrows() * x.ncols() * labelSize);
+		ScratchScope scratch;
 		/*
 		assert(x.nrows() > 0 && x.ncols() == x.nrows() && x.nrows() == answer.size() && x.nrows() == answer[0].size());
 		int nDim = x[0][0]->dim;
@@ -285,9 +298,10 @@ public:
 		}*/
 
 		int seq_size = x.nrows();
+		settle(x);
 		// comute alpha values, only the above parts are valid
-		NRMat3d<dtype> alpha(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> alpha_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha_answer(seq_size, maxLen, labelSize);
 		alpha = 0.0; alpha_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -326,7 +340,7 @@ public:
 				buffer.push_back(alpha[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ = logsumexp(buffer);
+		ltype logZ = logsumexp(buffer);
 
 		buffer.clear();
 		for (int j = 0; j < labelSize; ++j) {
@@ -334,10 +348,22 @@ public:
 				buffer.push_back(alpha_answer[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ_answer = logsumexp(buffer);
+		ltype logZ_answer = logsumexp(buffer);
 
 		return (logZ - logZ_answer) / batchsize;
 	}
+
+protected:
+	//the deferred ones of the segments read
+	template<typename S>
+	inline void settle(const NRMat<NodeT<S>*>& x){
+		int seq_size = x.nrows();
+		for (int idx = 0; idx < seq_size; idx++) {
+			for (int dist = 0; dist < seq_size - idx && dist < maxLen; dist++) {
+				x[idx][dist]->settle();
+			}
+		}
+	}
 };
 
 
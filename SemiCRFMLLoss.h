@@ -5,11 +5,13 @@
 #include "Metric.h"
 #include "Param.h"
 #include "Node.h"
+#include "Profiler.h"
+#include "ScratchArena.h"
 
 struct SemiCRFMLLoss{
 public:
 	int labelSize;
-	vector<dtype> buffer;
+	vector<ltype> buffer;
 	dtype eps;
 	vector<int> maxLens;
 	int maxLen;
@@ -50,7 +52,10 @@ public:
 
 public:
 	// 
-	inline dtype loss(const NRMat<PNode>& x, const vector<vector<vector<dtype> > >& answer, Metric& eval, int batchsize = 1){
+	template<typename S>
+	inline dtype loss(const NRMat<NodeT<S>*>& x, const vector<vector<vector<dtype> > >& answer, Metric& eval, int batchsize = 1){
+		ProfileScope scope("SemiCRFMLLoss::loss", 4.0 * x.nrows() * x.ncols() * labelSize * labelSize);
+		ScratchScope scratch;
 		/*
 		assert(x.nrows() > 0 && x.ncols() == x.nrows() && x.nrows() == answer.size() && x.nrows() == answer[0].size());
 		int nDim = x[0][0]->dim;
@@ -60,6 +65,7 @@ public:
 		}*/
 
 		int seq_size = x.nrows();
+		settle(x);
 		//int maxLength = x.ncols();
 
 		for (int idx = 0; idx < seq_size; idx++) {
@@ -70,8 +76,8 @@ public:
 
 
 		// comute alpha values, only the above parts are valid
-		NRMat3d<dtype> alpha(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> alpha_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha_answer(seq_size, maxLen, labelSize);
 		alpha = 0.0; alpha_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -110,7 +116,7 @@ public:
 				buffer.push_back(alpha[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ = logsumexp(buffer);
+		ltype logZ = logsumexp(buffer);
 
 		buffer.clear();
 		for (int j = 0; j < labelSize; ++j) {
@@ -118,13 +124,13 @@ public:
 				buffer.push_back(alpha_answer[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ_answer = logsumexp(buffer);
+		ltype logZ_answer = logsumexp(buffer);
 
-		dtype cost = (logZ - logZ_answer) / batchsize;
+		ltype cost = (logZ - logZ_answer) / batchsize;
 
 		// comute belta values
-		NRMat3d<dtype> belta(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> belta_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> belta(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> belta_answer(seq_size, maxLen, labelSize);
 		belta = 0.0; belta_answer = 0.0;
 		for (int idx = seq_size; idx > 0; idx--) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -155,10 +161,10 @@ public:
 		}
 
 		//compute margins
-		NRMat3d<dtype> margin(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> margin_answer(seq_size, maxLen, labelSize);
-		NRMat<dtype> trans(labelSize, labelSize);
-		NRMat<dtype> trans_answer(labelSize, labelSize);
+		ScratchMat3d<ltype> margin(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> margin_answer(seq_size, maxLen, labelSize);
+		ScratchMat<ltype> trans(labelSize, labelSize);
+		ScratchMat<ltype> trans_answer(labelSize, labelSize);
 		margin = 0.0; margin_answer = 0.0;
 		trans = 0.0; trans_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
@@ -170,7 +176,7 @@ public:
 					if (idx > 0) {
 						for (int j = 0; j < labelSize; ++j) {
 							for (int prevdist = 1; prevdist <= idx && prevdist <= maxLens[j]; prevdist++) {
-								dtype logvalue = alpha[idx - prevdist][prevdist - 1][j] + x[idx][dist]->val[i] + T.val[j][i] + belta[idx][dist][i] - logZ;
+								ltype logvalue = alpha[idx - prevdist][prevdist - 1][j] + x[idx][dist]->val[i] + T.val[j][i] + belta[idx][dist][i] - logZ;
 								trans[j][i] += exp(logvalue);
 								logvalue = alpha_answer[idx - prevdist][prevdist - 1][j] + x[idx][dist]->val[i] + T.val[j][i] + belta_answer[idx][dist][i] - logZ_answer;
 								trans_answer[j][i] += exp(logvalue);
@@ -207,7 +213,10 @@ public:
 	}
 
 	//viterbi decode algorithm
-	inline void predict(const NRMat<PNode>& x, NRMat<int>& y){
+	template<typename S>
+	inline void predict(const NRMat<NodeT<S>*>& x, NRMat<int>& y){
+		ProfileScope scope("SemiCRFMLLoss::predict", 4.0 * x.nrows() * x.ncols() * labelSize * labelSize);
+		ScratchScope scratch;
 		/*
 		assert(x.nrows() > 0 && x.ncols() == x.nrows());
 		int nDim = x[0][0]->dim;
@@ -217,11 +226,12 @@ public:
 		}*/
 
 		int seq_size = x.nrows();
+		settle(x);
 
-		NRMat3d<dtype> maxScores(seq_size, maxLen, labelSize);
-		NRMat3d<int> maxLastLabels(seq_size, maxLen, labelSize);
-		NRMat3d<int> maxLastStarts(seq_size, maxLen, labelSize);
-		NRMat3d<int> maxLastDists(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> maxScores(seq_size, maxLen, labelSize);
+		ScratchMat3d<int> maxLastLabels(seq_size, maxLen, labelSize);
+		ScratchMat3d<int> maxLastStarts(seq_size, maxLen, labelSize);
+		ScratchMat3d<int> maxLastDists(seq_size, maxLen, labelSize);
 
 		maxScores = 0.0; maxLastLabels = -2; 
 		maxLastStarts = -2; maxLastDists = -2;
@@ -239,10 +249,10 @@ public:
 						int maxLastLabel = -1;
 						int maxLastStart = -1;
 						int LastDist = -1;
-						dtype maxscore = 0.0;
+						ltype maxscore = 0.0;
 						for (int j = 0; j < labelSize; ++j) {
 							for (int prevdist = 1; prevdist <= idx && prevdist <= maxLens[j]; prevdist++) {
-								dtype curScore = T.val[j][i] + x[idx][dist]->val[i] + maxScores[idx - prevdist][prevdist - 1][j];
+								ltype curScore = T.val[j][i] + x[idx][dist]->val[i] + maxScores[idx - prevdist][prevdist - 1][j];
 								if (maxLastLabel == -1 || curScore > maxscore){
 									maxLastLabel = j;
 									maxLastStart = idx - prevdist;
@@ -264,13 +274,13 @@ public:
 		// below zero denotes no such segment
 		y.resize(seq_size, maxLen);
 		y = -1;
-		dtype maxFinalScore = 0.0;
+		ltype maxFinalScore = 0.0;
 		int maxFinalLabel = -1;
 		int maxFinalStart = -1;
 		int maxFinalDist = -1;
 		for (int j = 0; j < labelSize; ++j) {
 			for (int dist = 1; dist <= seq_size && dist <= maxLens[j]; dist++) {
-				dtype curScore = maxScores[seq_size - dist][dist - 1][j];
+				ltype curScore = maxScores[seq_size - dist][dist - 1][j];
 				if (maxFinalLabel == -1 || curScore > maxFinalScore){
 					maxFinalLabel = j;
 					maxFinalStart = seq_size - dist;
@@ -300,7 +310,10 @@ public:
 
 	}
 
-	inline dtype cost(const NRMat<PNode>& x, const vector<vector<vector<dtype> > >& answer, int batchsize = 1){
+	template<typename S>
+	inline ltype cost(const NRMat<NodeT<S>*>& x, const vector<vector<vector<dtype> > >& answer, int batchsize = 1){
+		ProfileScope scope("SemiCRFMLLoss::cost", 4.0 * x.nrows() * x.ncols() * labelSize * labelSize);
+		ScratchScope scratch;
 		/*
 		assert(x.nrows() > 0 && x.ncols() == x.nrows() && x.nrows() == answer.size() && x.nrows() == answer[0].size());
 		int nDim = x[0][0]->dim;
@@ -310,9 +323,10 @@ public:
 		}*/
 
 		int seq_size = x.nrows();
+		settle(x);
 		// comute alpha values, only the above parts are valid
-		NRMat3d<dtype> alpha(seq_size, maxLen, labelSize);
-		NRMat3d<dtype> alpha_answer(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha(seq_size, maxLen, labelSize);
+		ScratchMat3d<ltype> alpha_answer(seq_size, maxLen, labelSize);
 		alpha = 0.0; alpha_answer = 0.0;
 		for (int idx = 0; idx < seq_size; idx++) {
 			for (int i = 0; i < labelSize; ++i) {
@@ -351,7 +365,7 @@ public:
 				buffer.push_back(alpha[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ = logsumexp(buffer);
+		ltype logZ = logsumexp(buffer);
 
 		buffer.clear();
 		for (int j = 0; j < labelSize; ++j) {
@@ -359,10 +373,22 @@ public:
 				buffer.push_back(alpha_answer[seq_size - dist][dist - 1][j]);
 			}
 		}
-		dtype logZ_answer = logsumexp(buffer);
+		ltype logZ_answer = logsumexp(buffer);
 
 		return (logZ - logZ_answer) / batchsize;
 	}
+
+protected:
+	//the deferred ones of the segments read
+	template<typename S>
+	inline void settle(const NRMat<NodeT<S>*>& x){
+		int seq_size = x.nrows();
+		for (int idx = 0; idx < seq_size; idx++) {
+			for (int dist = 0; dist < seq_size - idx && dist < maxLen; dist++) {
+				x[idx][dist]->settle();
+			}
+		}
+	}
 };
 
 
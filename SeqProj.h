@@ -0,0 +1,313 @@
+#ifndef SEQPROJ_H_
+#define SEQPROJ_H_
+
+#include "MyLib.h"
+#include "Node.h"
+#include "Param.h"
+#include "Graph.h"
+
+// the input side of a recurrent layer for all the steps at once: P = W[:, col : col + I] X by one GEMM,
+// where X = [x_0 ... x_T-1], and the gradients of that block by one GEMM in backward.
+// the step t reads column(t) in place of its own product with x_t, and adds the loss of its gates to lossColumn(t),
+// so only the products with the hidden stay in the recurrence.
+struct SeqProjNode : Node {
+public:
+	vector<PNode> ins;
+	Param* param;
+	int col, inDim, rows;
+	int nSize;
+	int capacity, maxsize;  //steps with memory, and at most
+	AlignedMemoryPool* pool;
+	Tensor2D x, lx;  //the inputs side by side, and their losses
+
+public:
+	SeqProjNode() : Node() {
+		param = NULL;
+		col = inDim = rows = 0;
+		nSize = 0;
+		capacity = maxsize = 0;
+		pool = NULL;
+	}
+
+	inline void clearValue() {
+		Node::clearValue();
+		ins.clear();
+		nSize = 0;
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline double flops() const {
+		return 2.0 * rows * inDim * nSize;
+	}
+
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	//W[:, col : col + inDim] of at most maxsize steps
+	inline void init(Param* W, int col, int inDim, int maxsize, AlignedMemoryPool* mem = NULL) {
+		param = W;
+		this->col = col;
+		this->inDim = inDim;
+		rows = W->val.row;
+		this->maxsize = maxsize;
+		pool = mem;
+		capacity = 0;
+	}
+
+	//the values are not kept, called before the forward, as SoftmaxNode::reserve
+	inline void reserve(int size) {
+		if (size <= capacity) return;
+		AlignedMemoryPool* mem = capacity == 0 ? AlignedMemoryPool::growth(pool) : AlignedMemoryPool::heap();
+		int target = 2 * capacity < maxsize ? 2 * capacity : maxsize;
+		capacity = target > size ? target : size;
+		val.release();
+		loss.release();
+		x.release();
+		lx.release();
+		Node::init(capacity * rows, -1, mem);
+		x.init(inDim, capacity, mem);
+		if (!inference) lx.init(inDim, capacity, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + x.bytes() + lx.bytes();
+	}
+
+	inline dtype* column(int t) {
+		return val.v + t * rows;
+	}
+
+	inline dtype* lossColumn(int t) {
+		return loss.v + t * rows;
+	}
+
+public:
+	void forward(Graph *cg, const vector<PNode>& xs) {
+		if (!link(xs)) return;
+		acquire(cg);
+		compute();
+		cg->addNode(this);
+	}
+
+	//the inputs only, compute and acquire are left to the caller, see BiCell.h
+	inline bool link(const vector<PNode>& xs) {
+		nSize = xs.size();
+		if (nSize < 1) {
+			std::cout << "at least one nodes are required" << std::endl;
+			return false;
+		}
+		reserve(nSize);
+		ins = xs;
+		return true;
+	}
+
+	inline void acquire(Graph *cg) {
+		for (int idx = 0; idx < nSize; idx++) {
+			cg->require(ins[idx]);
+			ins[idx]->increase_loc();
+		}
+	}
+
+	inline void compute() {
+		for (int idx = 0; idx < nSize; idx++) {
+			x.mat().col(idx) = ins[idx]->val.mat();
+		}
+		MatT<dtype> proj(val.v, rows, nSize);
+		proj.noalias() = param->val.mat().block(0, col, rows, inDim) * x.mat().leftCols(nSize);
+	}
+
+	void backward() {
+		MatT<dtype> lproj(loss.v, rows, nSize);
+		param->grad.mat().block(0, col, rows, inDim).noalias() += lproj * x.mat().leftCols(nSize).transpose();
+		lx.mat().leftCols(nSize).noalias() = param->val.mat().block(0, col, rows, inDim).transpose() * lproj;
+		for (int idx = 0; idx < nSize; idx++) {
+			ins[idx]->loss.mat() += lx.mat().col(idx);
+		}
+	}
+
+	inline void unlock() {
+		for (int idx = 0; idx < nSize; idx++) {
+			ins[idx]->decrease_loc();
+		}
+		if (!lossed) return;
+		for (int idx = 0; idx < nSize; idx++) {
+			ins[idx]->lossed = true;
+		}
+	}
+};
+
+// a gate of a recurrent step whose input side is column t of a SeqProjNode: y = f(W1 x1 + W2 x2 + P[:, t] + b),
+// where W2 and b may be NULL, e.g., the TriNode and BiNode gates of LSTMBuilder and RNNBuilder without their x terms
+struct SeqStepNode : Node {
+public:
+	PNode in1, in2;
+	SeqProjNode* proj;
+	int step;
+	Tensor1D ty, lty;
+
+	Param *W1, *W2, *b;
+
+	dtype (*activate)(const dtype&);   // activation function
+	dtype (*derivate)(const dtype&, const dtype&);  // derivation function of activation function
+
+public:
+	SeqStepNode() : Node() {
+		in1 = NULL;
+		in2 = NULL;
+		proj = NULL;
+		step = 0;
+		W1 = W2 = b = NULL;
+		activate = ftanh;
+		derivate = dtanh;
+	}
+
+	inline void setParam(Param* W1, Param* W2, Param* b) {
+		this->W1 = W1;
+		this->W2 = W2;
+		this->b = b;
+	}
+
+	inline void setFunctions(dtype (*f)(const dtype&), dtype (*f_deri)(const dtype&, const dtype&)) {
+		activate = f;
+		derivate = f_deri;
+	}
+
+	inline double flops() const {
+		return 2.0 * (W1->inDim() + (W2 ? W2->inDim() : 0)) * dim;
+	}
+
+	inline void clearValue() {
+		Node::clearValue();
+		in1 = NULL;
+		in2 = NULL;
+		proj = NULL;
+		ty.zero();
+		lty.zero();
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL) {
+		Node::init(dim, dropOut, mem);
+		ty.init(dim, mem);
+		if (!inference) lty.init(dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes() + lty.bytes();
+	}
+
+public:
+	//x2 is NULL without W2, the projection p is run before
+	void forward(Graph *cg, PNode x1, PNode x2, SeqProjNode* p, int t) {
+		in1 = x1;
+		in2 = x2;
+		proj = p;
+		step = t;
+		in1->increase_loc();
+		if (in2) in2->increase_loc();
+		proj->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
+		ty.mat().noalias() = W1->val.mat() * in1->val.mat();
+		if (W2) ty.mat().noalias() += W2->val.mat() * in2->val.mat();
+		finish();
+	}
+
+	//adds the projection and the bias to W1 x1 + W2 x2 in ty, and activates
+	inline void finish() {
+		ty.vec() += VecT<dtype>(proj->column(step), dim);
+		if (b) ty.vec() += b->val.vec();
+		activate_forward(activate, ty, val);
+	}
+
+	void backward() {
+		activate_backward(derivate, ty, val, loss, lty, false);
+
+		W1->grad.mat().noalias() += lty.mat() * in1->val.tmat();
+		in1->loss.mat().noalias() += W1->val.mat().transpose() * lty.mat();
+		if (W2) {
+			W2->grad.mat().noalias() += lty.mat() * in2->val.tmat();
+			in2->loss.mat().noalias() += W2->val.mat().transpose() * lty.mat();
+		}
+		if (b) b->grad.vec() += lty.vec();
+		VecT<dtype>(proj->lossColumn(step), dim) += lty.vec();
+	}
+
+public:
+	inline const void* paramKey() const {
+		return W1;
+	}
+
+	// one GEMM per weight for all the nodes sharing W1, hence W2 and b
+	inline void forward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBuffer x1(W1->inDim(), count), y(dim, count);
+		MatBuffer x2(W2 ? W2->inDim() : 0, count);
+		for (int idx = 0; idx < count; idx++) {
+			SeqStepNode* ptr = (SeqStepNode*)batch[idx];
+			x1.col(idx) = ptr->in1->val.mat();
+			if (W2) x2.col(idx) = ptr->in2->val.mat();
+		}
+
+		y.noalias() = W1->val.mat() * x1;
+		if (W2) y.noalias() += W2->val.mat() * x2;
+
+		for (int idx = 0; idx < count; idx++) {
+			SeqStepNode* ptr = (SeqStepNode*)batch[idx];
+			ptr->ty.mat() = y.col(idx);
+			ptr->finish();
+		}
+	}
+
+	inline void backward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBuffer x1(W1->inDim(), count), ly(dim, count), lx1(W1->inDim(), count);
+		MatBuffer x2(W2 ? W2->inDim() : 0, count), lx2(W2 ? W2->inDim() : 0, count);
+		for (int idx = 0; idx < count; idx++) {
+			SeqStepNode* ptr = (SeqStepNode*)batch[idx];
+			activate_backward(ptr->derivate, ptr->ty, ptr->val, ptr->loss, ptr->lty, false);
+			ly.col(idx) = ptr->lty.mat();
+			x1.col(idx) = ptr->in1->val.mat();
+			if (W2) x2.col(idx) = ptr->in2->val.mat();
+			VecT<dtype>(ptr->proj->lossColumn(ptr->step), dim) += ptr->lty.vec();
+		}
+
+		W1->grad.mat().noalias() += ly * x1.transpose();
+		lx1.noalias() = W1->val.mat().transpose() * ly;
+		if (W2) {
+			W2->grad.mat().noalias() += ly * x2.transpose();
+			lx2.noalias() = W2->val.mat().transpose() * ly;
+		}
+		if (b) b->grad.mat() += ly.rowwise().sum();
+
+		for (int idx = 0; idx < count; idx++) {
+			SeqStepNode* ptr = (SeqStepNode*)batch[idx];
+			ptr->in1->loss.mat() += lx1.col(idx);
+			if (W2) ptr->in2->loss.mat() += lx2.col(idx);
+		}
+	}
+
+	inline void unlock() {
+		in1->decrease_loc();
+		if (in2) in2->decrease_loc();
+		proj->decrease_loc();
+		if (!lossed) return;
+		in1->lossed = true;
+		if (in2) in2->lossed = true;
+		proj->lossed = true;
+	}
+};
+
+#endif
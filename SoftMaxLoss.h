@@ -4,11 +4,17 @@
 #include "MyLib.h"
 #include "Metric.h"
 #include "Node.h"
+#include "Profiler.h"
+#include "ScratchArena.h"
 
 
 struct SoftMaxLoss{
 public:
-	inline dtype loss(PNode x, const vector<dtype> &answer, Metric& eval, int batchsize = 1){
+	template<typename S>
+	inline dtype loss(NodeT<S>* x, const vector<dtype> &answer, Metric& eval, int batchsize = 1){
+		ProfileScope scope("SoftMaxLoss::loss", 4.0 * x->dim);
+		ScratchScope scratch;
+		x->settle();
 		int nDim = x->dim;
 		int labelsize = answer.size();
 		if (labelsize != nDim) {
@@ -17,7 +23,7 @@ public:
 		}
 		x->lossed = true;
 
-		NRVec<dtype> scores(nDim);
+		ScratchVec<dtype> scores(nDim);
 
 		dtype cost = 0.0;
 		int optLabel = -1;
@@ -53,7 +59,11 @@ public:
 
 	}
 
-	inline dtype predict(PNode x, int& y){
+	template<typename S>
+	inline dtype predict(NodeT<S>* x, int& y){
+		ProfileScope scope("SoftMaxLoss::predict", 4.0 * x->dim);
+		ScratchScope scratch;
+		x->settle();
 		int nDim = x->dim;
 
 		int optLabel = -1;
@@ -64,7 +74,7 @@ public:
 
 		dtype prob = 0.0;
 		dtype sum = 0.0;
-		NRVec<dtype> scores(nDim);
+		ScratchVec<dtype> scores(nDim);
 		dtype maxScore = x->val[optLabel];
 		for (int i = 0; i < nDim; ++i) {
 			scores[i] = exp(x->val[i] - maxScore);
@@ -75,7 +85,11 @@ public:
 		return prob;
 	}
 
-	inline dtype cost(PNode x, const vector<dtype> &answer, int batchsize = 1){
+	template<typename S>
+	inline dtype cost(NodeT<S>* x, const vector<dtype> &answer, int batchsize = 1){
+		ProfileScope scope("SoftMaxLoss::cost", 4.0 * x->dim);
+		ScratchScope scratch;
+		x->settle();
 		int nDim = x->dim;
 		int labelsize = answer.size();
 		if (labelsize != nDim) {
@@ -83,7 +97,7 @@ public:
 			return -1.0;
 		}
 
-		NRVec<dtype> scores(nDim);
+		ScratchVec<dtype> scores(nDim);
 
 		dtype cost = 0.0;
 
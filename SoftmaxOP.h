@@ -7,10 +7,12 @@
 #include "AtomicOP.h"
 
 
-//default val dim = max_length * atomic_dim
+//val dim = capacity * unit_dim, the capacity grows by forward with the number of inputs
 struct SoftmaxNode : Node {
 private:
-	int maxsize;
+	int maxsize;  //the capacity doubles up to maxsize, and grows to the inputs beyond it
+	int capacity;
+	AlignedMemoryPool* pool;
 public:
 	vector<PNode> ins;
 	Tensor1D maxv, expv, sumexpv;
@@ -23,6 +25,8 @@ public:
 		nSize = 0;
 		unit_dim = 0;
 		maxsize = max_length;
+		capacity = 0;
+		pool = NULL;
 	}
 	
 	~SoftmaxNode(){
@@ -47,12 +51,31 @@ public:
 	//note: please this is the unit dim	
 	inline void init(int unit_dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
 		this->unit_dim = unit_dim;
-		Node::init(maxsize * unit_dim, -1, mem);
-		expv.init(maxsize * unit_dim, mem);
+		pool = mem;
+		capacity = 0;
+		reserve(1);
 		maxv.init(unit_dim, mem);
 		sumexpv.init(unit_dim, mem);
 	}
 
+	//the values are not kept, called before the forward.
+	//the first size is taken from the pool, the larger ones from the heap, so release frees the smaller ones
+	inline void reserve(int size){
+		if (size <= capacity) return;
+		AlignedMemoryPool* mem = capacity == 0 ? AlignedMemoryPool::growth(pool) : AlignedMemoryPool::heap();
+		int target = 2 * capacity < maxsize ? 2 * capacity : maxsize;
+		capacity = target > size ? target : size;
+		val.release();
+		loss.release();
+		expv.release();
+		Node::init(capacity * unit_dim, -1, mem);
+		expv.init(capacity * unit_dim, mem);
+	}
+
+	inline size_t bytes() const {
+		return Node::bytes() + maxv.bytes() + expv.bytes() + sumexpv.bytes();
+	}
+
 public:
 	// please better restrict col to 1
 	void forward(Graph *cg, const vector<PNode>& x) {
@@ -133,8 +156,11 @@ public:
 
 public:
 	void forward() {
-		if(nSize > max_length) std::cout << "length overflow" << std::endl;
-			
+		reserve(nSize);
+		for (int idx = 0; idx < nSize; idx++){
+			ins[idx]->increase_loc();
+		}
+
 		for(int idy = 0; idy < unit_dim; idy++){
 			maxv[idy] = ins[0]->val[idy];
 			for (int idx = 1; idx < nSize; idx++){
@@ -174,11 +200,6 @@ public:
 			std::cout << ": sumexp"  << sumexpv[idy] << std::endl;
 		}
 		*/
-
-		for (int idx = 0; idx < nSize; idx++){
-			ins[idx]->increase_loc();
-		}
-				
 	}
 
 	void backward(){
@@ -216,6 +237,9 @@ public:
 	vector<SelectionNode> _output;
 	int _dim;
 
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+
 public:
 	SoftmaxBuilder() {
 		clear();
@@ -233,16 +257,29 @@ public:
 	inline void clear() {
 		_output.clear();
 		_dim = 0;
+		_capacity = 0;
+		_mem = NULL;
 	}
 
 public:
 	inline void init(int inDim, AlignedMemoryPool* mem = NULL) {
 		_dim = inDim;
 		_softmax.init(_dim, -1, mem);
-		int maxsize = _output.size();
-		for (int idx = 0; idx < maxsize; idx++) {
+		_capacity = 0;
+		_mem = mem;
+	}
+
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		if (!reserveNodes("softmax builder", size, _output.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
 			_output[idx].init(_dim, -1, mem);
-		}
+		})) return false;
+		_softmax.reserve(_capacity);
+		return true;
+	}
+
+	inline size_t bytes() const {
+		return _softmax.bytes() + nodeBytes(_output);
 	}
 
 	inline void forward(Graph *cg, const vector<PNode>& x) {
@@ -255,6 +292,7 @@ public:
 			std::cout << "input dim dose not match for softmax builder operation" << std::endl;
 			return;
 		}
+		if (!reserve(nSize)) return;
 
 		_softmax.forward(cg, x);
 
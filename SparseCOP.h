@@ -109,6 +109,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -234,6 +238,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -356,6 +364,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -480,6 +492,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -602,6 +618,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -724,6 +744,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -845,6 +869,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx = -1;
@@ -964,6 +992,10 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		ins.clear();
@@ -72,6 +72,14 @@ public:
 		param = paramInit;
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline double flops() const {
+		return (double)tx.size() * dim;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		tx.clear();
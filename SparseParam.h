@@ -12,18 +12,27 @@
 
  // Notice: aux_square is an aux_squareiliary variable to help parameter updating
  // The in-out dimension definiation is different with dense parameters.
-struct SparseParam : BaseParam {
-    Tensor2D aux_square;
-    Tensor2D aux_mean;
+template<typename T>
+struct SparseParamT : BaseParamT<T> {
+    using BaseParamT<T>::val;
+    using BaseParamT<T>::grad;
+
+    Tensor2DT<T> aux_square;
+    Tensor2DT<T> aux_mean;
     unordered_set<int> indexers;
     NRVec<int> last_update;
+    SparseParamT* owner;  // whose optimizer states are shared by this one, NULL by default
+
+    SparseParamT() {
+        owner = NULL;
+    }
 
 
     // allow sparse and dense parameters have different parameter initialization methods
     inline void initial(int outDim, int inDim, AlignedMemoryPool* mem = NULL) {
         //not in the aligned memory pool
         val.init(outDim, inDim);
-        dtype bound = sqrt(3.0 / (outDim));
+        T bound = sqrt(3.0 / (outDim));
         val.random(bound);
         grad.init(outDim, inDim);
         aux_square.init(outDim, inDim);
@@ -52,7 +61,7 @@ struct SparseParam : BaseParam {
         return val.col;
     }
 
-    inline void updateAdagrad(dtype alpha, dtype reg, dtype eps) {
+    inline void updateAdagrad(T alpha, T reg, T eps) {
         unordered_set<int>::iterator it;
         for (it = indexers.begin(); it != indexers.end(); ++it) {
             int index = *it;
@@ -64,9 +73,10 @@ struct SparseParam : BaseParam {
         }
     }
 
-    inline void updateAdam(dtype belta1, dtype belta2, dtype alpha, dtype reg, dtype eps) {
+    inline void updateAdam(T belta1, T belta2, T alpha, T reg, T eps) {
         unordered_set<int>::iterator it;
-        dtype lr_t;
+        T lr_t;
+        NRVec<int>& last_update = owner ? owner->last_update : this->last_update;
         for (it = indexers.begin(); it != indexers.end(); ++it) {
             int index = *it;
             for (int idx = 0; idx < grad.row; idx++) {
@@ -101,9 +111,9 @@ struct SparseParam : BaseParam {
         idy = idRows[0];
     }
 
-    inline dtype squareGradNorm() {
+    inline T squareGradNorm() {
         unordered_set<int>::iterator it;
-        dtype sumNorm = 0.0;
+        T sumNorm = 0.0;
         for (it = indexers.begin(); it != indexers.end(); ++it) {
             int index = *it;
             for (int idx = 0; idx < val.row; idx++) {
@@ -114,7 +124,7 @@ struct SparseParam : BaseParam {
         return sumNorm;
     }
 
-    inline void rescaleGrad(dtype scale) {
+    inline void rescaleGrad(T scale) {
         unordered_set<int>::iterator it;
         for (it = indexers.begin(); it != indexers.end(); ++it) {
             int index = *it;
@@ -124,7 +134,30 @@ struct SparseParam : BaseParam {
         }
     }
 
-    inline void value(const int& featId, Tensor1D& out) {
+    // rows are updated by several replicas without locks,
+    // concurrent writes to the same row may lose part of an update, which is tolerated by sgd
+    inline void shareState(BaseParamT<T>* master) {
+        SparseParamT* ptr = (SparseParamT*)master;
+        val.share(ptr->val);
+        aux_square.share(ptr->aux_square);
+        aux_mean.share(ptr->aux_mean);
+        owner = ptr->owner ? ptr->owner : ptr;
+    }
+
+    //only the rows touched by the replica are merged
+    inline void addGrad(BaseParamT<T>* replica) {
+        SparseParamT* ptr = (SparseParamT*)replica;
+        unordered_set<int>::iterator it;
+        for (it = ptr->indexers.begin(); it != ptr->indexers.end(); ++it) {
+            int index = *it;
+            indexers.insert(index);
+            for (int idx = 0; idx < val.row; idx++) {
+                grad[index][idx] += ptr->grad[index][idx];
+            }
+        }
+    }
+
+    inline void value(const int& featId, Tensor1DT<T>& out) {
         if (out.dim != val.row) {
             std::cout << "warning: output dim not equal lookup param dim." << std::endl;
         }
@@ -133,7 +166,7 @@ struct SparseParam : BaseParam {
         }
     }
 
-    inline void value(const vector<int>& featIds, Tensor1D& out) {
+    inline void value(const vector<int>& featIds, Tensor1DT<T>& out) {
         if (out.dim != val.row) {
             std::cout << "warning: output dim not equal lookup param dim." << std::endl;
         }
@@ -147,7 +180,7 @@ struct SparseParam : BaseParam {
         }
     }
 
-    inline void loss(const int& featId, const Tensor1D& loss) {
+    inline void loss(const int& featId, const Tensor1DT<T>& loss) {
         if (loss.dim != val.row) {
             std::cout << "warning: loss dim not equal lookup param dim." << std::endl;
         }
@@ -157,7 +190,7 @@ struct SparseParam : BaseParam {
         }
     }
 
-    inline void loss(const vector<int>& featIds, const Tensor1D& loss) {
+    inline void loss(const vector<int>& featIds, const Tensor1DT<T>& loss) {
         if (loss.dim != val.row) {
             std::cout << "warning: loss dim not equal lookup param dim." << std::endl;
         }
@@ -172,6 +205,13 @@ struct SparseParam : BaseParam {
         }
     }
 
+    //last_update is counted as optimizer state
+    inline ParamBytes bytes() const {
+        ParamBytes res = BaseParamT<T>::bytes();
+        res.optimizer = aux_square.bytes() + aux_mean.bytes() + last_update.size() * sizeof(int);
+        return res;
+    }
+
     inline void save(std::ofstream &os)const {
         val.save(os);
         aux_square.save(os);
@@ -196,4 +236,6 @@ struct SparseParam : BaseParam {
 
 };
 
+typedef SparseParamT<dtype> SparseParam;
+
 #endif /* SPARSEPARAM_H_ */
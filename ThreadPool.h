@@ -0,0 +1,86 @@
+#ifndef N3L_THREADPOOL_H
+#define N3L_THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// a fixed group of worker threads, which run the same task together
+// run(task) calls task(0), ..., task(size() - 1) concurrently and waits for all of them
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable task_ready, task_done;
+	std::function<void(int)> task;
+	int generation;
+	int remaining;
+	bool stop;
+
+public:
+	ThreadPool(int size) {
+		generation = 0;
+		remaining = 0;
+		stop = false;
+		for (int idx = 0; idx < size; idx++) {
+			workers.push_back(std::thread(&ThreadPool::loop, this, idx));
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::unique_lock<std::mutex> guard(mtx);
+			stop = true;
+		}
+		task_ready.notify_all();
+		for (int idx = 0; idx < workers.size(); idx++) {
+			workers[idx].join();
+		}
+		workers.clear();
+	}
+
+public:
+	inline int size() const {
+		return workers.size();
+	}
+
+	inline void run(const std::function<void(int)>& func) {
+		if (workers.size() == 0) return;
+		std::unique_lock<std::mutex> guard(mtx);
+		task = func;
+		remaining = workers.size();
+		generation++;
+		task_ready.notify_all();
+		while (remaining > 0) {
+			task_done.wait(guard);
+		}
+		task = NULL;
+	}
+
+private:
+	void loop(int id) {
+		int seen = 0;
+		while (true) {
+			std::function<void(int)> current;
+			{
+				std::unique_lock<std::mutex> guard(mtx);
+				while (!stop && generation == seen) {
+					task_ready.wait(guard);
+				}
+				if (stop) return;
+				seen = generation;
+				current = task;
+			}
+
+			current(id);
+
+			std::unique_lock<std::mutex> guard(mtx);
+			remaining--;
+			if (remaining == 0) task_done.notify_all();
+		}
+	}
+};
+
+#endif
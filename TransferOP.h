@@ -77,6 +77,10 @@ public:
 	inline void setParam(TransferParams* paramInit) {
 		param = paramInit;
 	}
+
+	inline const void* paramKey() const {
+		return param;
+	}
 	
 	inline void clearValue(){
 		Node::clearValue();
@@ -88,6 +92,7 @@ public:
 public:
 	void forward(Graph *cg, PNode x, const string& strNorm) {
 		in = x;		
+		in->increase_loc();
 		xid = param->getElemId(strNorm);
 		if(xid >= 0){
 			val.mat() = param->W[xid].val.mat() * in->val.mat();
@@ -97,7 +102,6 @@ public:
 			val = 0;
 		}
 
-		in->increase_loc();
 		cg->addNode(this);
 	}
 
@@ -13,21 +13,22 @@
 #include "Node.h"
 #include "Graph.h"
 
-struct TriParams {
+template<typename T>
+struct TriParamsT {
 public:
-	Param W1;
-	Param W2;
-	Param W3;
-	Param b;
+	ParamT<T> W1;
+	ParamT<T> W2;
+	ParamT<T> W3;
+	ParamT<T> b;
 
 	bool bUseB;
 
 public:
-	TriParams() {
+	TriParamsT() {
 		bUseB = true;
 	}
 
-	inline void exportAdaParams(ModelUpdate& ada) {
+	inline void exportAdaParams(ModelUpdateT<T>& ada) {
 		ada.addParam(&W1);
 		ada.addParam(&W2);
 		ada.addParam(&W3);
@@ -69,24 +70,36 @@ public:
 
 };
 
+typedef TriParamsT<dtype> TriParams;
+
 // non-linear feed-forward node
 // input nodes should be specified by forward function
 // for input variables, we exploit column vector,
 // which means a concrete input vector x_i is represented by x(0, i), x(1, i), ..., x(n, i)
-struct TriNode : Node {
+template<typename T>
+struct TriNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
+	using Node::inference;
+
 public:
 	PNode in1, in2, in3;
-	Tensor1D ty, lty;  // t means temp, ty is to save temp vector before activation
+	Tensor1DT<T> ty, lty;  // t means temp, ty is to save temp vector before activation
 
 	int inDim1, inDim2, inDim3;
 
-	TriParams* param;
+	TriParamsT<T>* param;
 
-	dtype (*activate)(const dtype&);   // activation function
-	dtype (*derivate)(const dtype&, const dtype&);  // derivation function of activation function
+	T (*activate)(const T&);   // activation function
+	T (*derivate)(const T&, const T&);  // derivation function of activation function
 
 public:
-	TriNode() : Node(){
+	TriNodeT() : Node(){
 		in1 = NULL;
 		in2 = NULL;
 		in3 = NULL;
@@ -100,13 +113,17 @@ public:
 		inDim3 = 0;		
 	}
 
-	inline void setParam(TriParams* paramInit) {
+	inline void setParam(TriParamsT<T>* paramInit) {
 		param = paramInit;
 		inDim1 = param->W1.inDim();
 		inDim2 = param->W2.inDim();
 		inDim3 = param->W3.inDim();
 	}
 
+	inline double flops() const {
+		return 2.0 * (inDim1 + inDim2 + inDim3) * dim;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		in1 = NULL;
@@ -116,41 +133,55 @@ public:
 		lty.zero();
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 	// define the activation function and its derivation form
-	inline void setFunctions(dtype (*f)(const dtype&), dtype (*f_deri)(const dtype&, const dtype&)) {
+	inline void setFunctions(T (*f)(const T&), T (*f_deri)(const T&, const T&)) {
 		activate = f;
 		derivate = f_deri;
 	}
 	
-	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+	inline void init(int dim, T dropOut, AlignedMemoryPool* mem = NULL){
 		Node::init(dim, dropOut, mem);
 		ty.init(dim, mem);
-		lty.init(dim, mem);
-	}		
+		if (!inference) lty.init(dim, mem);
+	}	
+
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes() + lty.bytes();
+	}	
 
 public:
 	void forward(Graph *cg, PNode x1, PNode x2, PNode x3) {
 		in1 = x1;
 		in2 = x2;
 		in3 = x3;
+		cg->require(in1);
+		cg->require(in2);
+		cg->require(in3);
+		in1->increase_loc();
+		in2->increase_loc();
+		in3->increase_loc();
+		if (cg->defer(this)) return;
 
+		compute();
+		cg->addNode(this);
+	}
+
+	inline void compute() {
 		ty.mat() = param->W1.val.mat() * in1->val.mat() + param->W2.val.mat() * in2->val.mat() + param->W3.val.mat() * in3->val.mat();
 		
 		if(param->bUseB){
 			ty.vec() += param->b.val.vec();
 		}
 		
-		val.vec() = ty.vec().unaryExpr(ptr_fun(activate));
-
-		in1->increase_loc();
-		in2->increase_loc();
-		in3->increase_loc();
-
-		cg->addNode(this);
+		activate_forward(activate, ty, val);
 	}
 
 	void backward() {
-		lty.vec() = loss.vec() * ty.vec().binaryExpr(val.vec(), ptr_fun(derivate));
+		activate_backward(derivate, ty, val, loss, lty, false);
 
 		param->W1.grad.mat() += lty.mat() * in1->val.tmat();
 		param->W2.grad.mat() += lty.mat() * in2->val.tmat();
@@ -165,6 +196,68 @@ public:
 		in3->loss.mat() += param->W3.val.mat().transpose() * lty.mat();
 	}
 
+public:
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	// one GEMM per weight for all the nodes sharing param
+	inline void forward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x1(inDim1, count), x2(inDim2, count), x3(inDim3, count), y(dim, count);
+		for (int idx = 0; idx < count; idx++) {
+			TriNodeT* ptr = (TriNodeT*)batch[idx];
+			x1.col(idx) = ptr->in1->val.mat();
+			x2.col(idx) = ptr->in2->val.mat();
+			x3.col(idx) = ptr->in3->val.mat();
+		}
+
+		y.noalias() = param->W1.val.mat() * x1;
+		y.noalias() += param->W2.val.mat() * x2;
+		y.noalias() += param->W3.val.mat() * x3;
+
+		for (int idx = 0; idx < count; idx++) {
+			TriNodeT* ptr = (TriNodeT*)batch[idx];
+			ptr->ty.mat() = y.col(idx);
+			if (param->bUseB) {
+				ptr->ty.vec() += param->b.val.vec();
+			}
+			activate_forward(ptr->activate, ptr->ty, ptr->val);
+		}
+	}
+
+	inline void backward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x1(inDim1, count), x2(inDim2, count), x3(inDim3, count), ly(dim, count);
+		MatBufferT<T> lx1(inDim1, count), lx2(inDim2, count), lx3(inDim3, count);
+		for (int idx = 0; idx < count; idx++) {
+			TriNodeT* ptr = (TriNodeT*)batch[idx];
+			activate_backward(ptr->derivate, ptr->ty, ptr->val, ptr->loss, ptr->lty, false);
+			ly.col(idx) = ptr->lty.mat();
+			x1.col(idx) = ptr->in1->val.mat();
+			x2.col(idx) = ptr->in2->val.mat();
+			x3.col(idx) = ptr->in3->val.mat();
+		}
+
+		param->W1.grad.mat().noalias() += ly * x1.transpose();
+		param->W2.grad.mat().noalias() += ly * x2.transpose();
+		param->W3.grad.mat().noalias() += ly * x3.transpose();
+
+		if (param->bUseB) {
+			param->b.grad.mat() += ly.rowwise().sum();
+		}
+
+		lx1.noalias() = param->W1.val.mat().transpose() * ly;
+		lx2.noalias() = param->W2.val.mat().transpose() * ly;
+		lx3.noalias() = param->W3.val.mat().transpose() * ly;
+		for (int idx = 0; idx < count; idx++) {
+			TriNodeT* ptr = (TriNodeT*)batch[idx];
+			ptr->in1->loss.mat() += lx1.col(idx);
+			ptr->in2->loss.mat() += lx2.col(idx);
+			ptr->in3->loss.mat() += lx3.col(idx);
+		}
+	}
+
 	inline void unlock(){
 		in1->decrease_loc();
 		in2->decrease_loc();
@@ -177,16 +270,27 @@ public:
 
 };
 
-struct LinearTriNode : Node {
+typedef TriNodeT<dtype> TriNode;
+
+template<typename T>
+struct LinearTriNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
+
 public:
 	PNode in1, in2, in3;
 
 	int inDim1, inDim2, inDim3;
 
-	TriParams* param;
+	TriParamsT<T>* param;
 
 public:
-	LinearTriNode() : Node(){
+	LinearTriNodeT() : Node(){
 		in1 = NULL;
 		in2 = NULL;
 		in3 = NULL;
@@ -198,13 +302,21 @@ public:
 		inDim3 = 0;		
 	}
 
-	inline void setParam(TriParams* paramInit) {
+	inline void setParam(TriParamsT<T>* paramInit) {
 		param = paramInit;
 		inDim1 = param->W1.inDim();
 		inDim2 = param->W2.inDim();
 		inDim3 = param->W3.inDim();
 	}
 
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline double flops() const {
+		return 2.0 * (inDim1 + inDim2 + inDim3) * dim;
+	}
+
 	inline void clearValue(){
 		Node::clearValue();
 		in1 = NULL;
@@ -217,20 +329,23 @@ public:
 		in1 = x1;
 		in2 = x2;
 		in3 = x3;
+		in1->increase_loc();
+		in2->increase_loc();
+		in3->increase_loc();
 
 		val.mat() = param->W1.val.mat() * in1->val.mat() + param->W2.val.mat() * in2->val.mat() + param->W3.val.mat() * in3->val.mat();
 		
 		if(param->bUseB){
 			val.vec() += param->b.val.vec();
 		}
-		
-		in1->increase_loc();
-		in2->increase_loc();
-		in3->increase_loc();
 
 		cg->addNode(this);
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
 	void backward() {
 		param->W1.grad.mat() += loss.mat() * in1->val.tmat();
 		param->W2.grad.mat() += loss.mat() * in2->val.tmat();
@@ -257,4 +372,6 @@ public:
 
 };
 
+typedef LinearTriNodeT<dtype> LinearTriNode;
+
 #endif /* TRIOP_H_ */
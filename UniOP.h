@@ -13,18 +13,19 @@
 #include "Node.h"
 #include "Graph.h"
 
-struct UniParams {
+template<typename T>
+struct UniParamsT {
 public:
-	Param W;
-	Param b;
+	ParamT<T> W;
+	ParamT<T> b;
 	bool bUseB;
 
 public:
-	UniParams() {
+	UniParamsT() {
 		bUseB = true;
 	}
 
-	inline void exportAdaParams(ModelUpdate& ada) {
+	inline void exportAdaParams(ModelUpdateT<T>& ada) {
 		ada.addParam(&W);
 		if (bUseB) {
 			ada.addParam(&b);
@@ -58,24 +59,36 @@ public:
 
 };
 
+typedef UniParamsT<dtype> UniParams;
+
 // non-linear feed-forward node
 // input nodes should be specified by forward function
 // for input variables, we exploit column vector,
 // which means a concrete input vector x_i is represented by x(0, i), x(1, i), ..., x(n, i)
-struct UniNode : Node{
+template<typename T>
+struct UniNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
+	using Node::inference;
+
 public:
 	PNode in;
-	Tensor1D ty, lty; // t means temp, ty is to save temp vector before activate
+	Tensor1DT<T> ty, lty; // t means temp, ty is to save temp vector before activate
 	int inDim;
 
-	UniParams* param;
+	UniParamsT<T>* param;
 
-	dtype (*activate)(const dtype&);   // activation function
-	dtype (*derivate)(const dtype&, const dtype&);  // derivation function of activation function
+	T (*activate)(const T&);   // activation function
+	T (*derivate)(const T&, const T&);  // derivation function of activation function
 
 
 public:
-	UniNode()  : Node(){
+	UniNodeT()  : Node(){
 		in = NULL;		
 		activate = ftanh;
 		derivate = dtanh;
@@ -85,10 +98,14 @@ public:
 	}
 
 
-	inline void setParam(UniParams* paramInit) {
+	inline void setParam(UniParamsT<T>* paramInit) {
 		param = paramInit;
 		inDim = param->W.inDim();
 	}
+
+	inline double flops() const {
+		return 2.0 * inDim * dim;
+	}
 	
 	inline void clearValue(){
 		Node::clearValue();
@@ -98,35 +115,48 @@ public:
 	}	
 
 	// define the activate function and its derivation form
-	inline void setFunctions(dtype (*f)(const dtype&), dtype (*f_deri)(const dtype&, const dtype&)) {
+	inline void setFunctions(T (*f)(const T&), T (*f_deri)(const T&, const T&)) {
 		activate = f;
 		derivate = f_deri;
 	}
+
+	inline bool overwrites() const {
+		return true;
+	}
 	
-	inline void init(int dim, dtype dropOut, AlignedMemoryPool* mem = NULL){
+	inline void init(int dim, T dropOut, AlignedMemoryPool* mem = NULL){
 		Node::init(dim, dropOut, mem);
 		ty.init(dim, mem);
-		lty.init(dim, mem);
+		if (!inference) lty.init(dim, mem);
 	}	
 
+	inline size_t bytes() const {
+		return Node::bytes() + ty.bytes() + lty.bytes();
+	}
+
 public:
 	void forward(Graph *cg, PNode x) {
 		in = x;
+		cg->require(in);
+		in->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
 
+	inline void compute() {
 		ty.mat() = param->W.val.mat() * in->val.mat();
 
 		if(param->bUseB){
 			ty.vec() += param->b.val.vec();
 		}
 		
-		val.vec() = ty.vec().unaryExpr(ptr_fun(activate));
-
-		in->increase_loc();
-		cg->addNode(this);
+		activate_forward(activate, ty, val);
 	}
 
 	void backward() {
-		lty.vec() = loss.vec() * ty.vec().binaryExpr(val.vec(), ptr_fun(derivate));
+		activate_backward(derivate, ty, val, loss, lty, false);
 
 		param->W.grad.mat() += lty.mat() * in->val.tmat();
 
@@ -138,6 +168,53 @@ public:
 		
 	}
 
+public:
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	// one GEMM for all the nodes sharing param
+	inline void forward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x(inDim, count), y(dim, count);
+		for (int idx = 0; idx < count; idx++) {
+			x.col(idx) = ((UniNodeT*)batch[idx])->in->val.mat();
+		}
+
+		y.noalias() = param->W.val.mat() * x;
+
+		for (int idx = 0; idx < count; idx++) {
+			UniNodeT* ptr = (UniNodeT*)batch[idx];
+			ptr->ty.mat() = y.col(idx);
+			if (param->bUseB) {
+				ptr->ty.vec() += param->b.val.vec();
+			}
+			activate_forward(ptr->activate, ptr->ty, ptr->val);
+		}
+	}
+
+	inline void backward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x(inDim, count), ly(dim, count), lx(inDim, count);
+		for (int idx = 0; idx < count; idx++) {
+			UniNodeT* ptr = (UniNodeT*)batch[idx];
+			activate_backward(ptr->derivate, ptr->ty, ptr->val, ptr->loss, ptr->lty, false);
+			ly.col(idx) = ptr->lty.mat();
+			x.col(idx) = ptr->in->val.mat();
+		}
+
+		param->W.grad.mat().noalias() += ly * x.transpose();
+
+		if (param->bUseB) {
+			param->b.grad.mat() += ly.rowwise().sum();
+		}
+
+		lx.noalias() = param->W.val.mat().transpose() * ly;
+		for (int idx = 0; idx < count; idx++) {
+			((UniNodeT*)batch[idx])->in->loss.mat() += lx.col(idx);
+		}
+	}
+
 
 	inline void unlock(){
 		in->decrease_loc();
@@ -147,16 +224,27 @@ public:
 
 };
 
-struct LinearUniNode : Node{
+typedef UniNodeT<dtype> UniNode;
+
+template<typename T>
+struct LinearUniNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
+
 public:
 	PNode in;
 	int inDim;
 
-	UniParams* param;
+	UniParamsT<T>* param;
 
 
 public:
-	LinearUniNode()  : Node(){
+	LinearUniNodeT()  : Node(){
 		in = NULL;
 
 		param = NULL;
@@ -165,10 +253,14 @@ public:
 	}
 
 
-	inline void setParam(UniParams* paramInit) {
+	inline void setParam(UniParamsT<T>* paramInit) {
 		param = paramInit;
 		inDim = param->W.inDim();
 	}
+
+	inline double flops() const {
+		return 2.0 * inDim * dim;
+	}
 	
 	inline void clearValue(){
 		Node::clearValue();
@@ -179,16 +271,24 @@ public:
 public:
 	void forward(Graph *cg, PNode x) {
 		in = x;
-		
+		cg->require(in);
+		in->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
+		cg->addNode(this);
+	}
+
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void compute() {
 		val.mat() = param->W.val.mat() * in->val.mat();
 
 		if(param->bUseB){
 			val.vec() += param->b.val.vec();
 		}
-		
-
-		in->increase_loc();
-		cg->addNode(this);
 	}
 
 	void backward() {
@@ -201,6 +301,50 @@ public:
 		in->loss.mat() += param->W.val.mat().transpose() * loss.mat();
 	}
 
+public:
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline void forward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x(inDim, count), y(dim, count);
+		for (int idx = 0; idx < count; idx++) {
+			x.col(idx) = ((LinearUniNodeT*)batch[idx])->in->val.mat();
+		}
+
+		y.noalias() = param->W.val.mat() * x;
+
+		for (int idx = 0; idx < count; idx++) {
+			LinearUniNodeT* ptr = (LinearUniNodeT*)batch[idx];
+			ptr->val.mat() = y.col(idx);
+			if (param->bUseB) {
+				ptr->val.vec() += param->b.val.vec();
+			}
+		}
+	}
+
+	inline void backward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x(inDim, count), ly(dim, count), lx(inDim, count);
+		for (int idx = 0; idx < count; idx++) {
+			LinearUniNodeT* ptr = (LinearUniNodeT*)batch[idx];
+			ly.col(idx) = ptr->loss.mat();
+			x.col(idx) = ptr->in->val.mat();
+		}
+
+		param->W.grad.mat().noalias() += ly * x.transpose();
+
+		if (param->bUseB) {
+			param->b.grad.mat() += ly.rowwise().sum();
+		}
+
+		lx.noalias() = param->W.val.mat().transpose() * ly;
+		for (int idx = 0; idx < count; idx++) {
+			((LinearUniNodeT*)batch[idx])->in->loss.mat() += lx.col(idx);
+		}
+	}
+
 
 	inline void unlock(){
 		in->decrease_loc();
@@ -210,20 +354,31 @@ public:
 
 };
 
+typedef LinearUniNodeT<dtype> LinearUniNode;
+
 // Linear Node, ofen used for computing output
 // input nodes should be specified by forward function
 // for input variables, we exploit column vector,
 // which means a concrete input vector x_i is represented by x(0, i), x(1, i), ..., x(n, i)
-struct LinearNode : Node{
+template<typename T>
+struct LinearNodeT : NodeT<T> {
+	typedef NodeT<T> Node;
+	typedef NodeT<T>* PNode;
+	typedef GraphT<T> Graph;
+	using Node::val;
+	using Node::loss;
+	using Node::dim;
+	using Node::lossed;
+
 public:
 	PNode in;
 	int inDim;
 
-	UniParams* param;
+	UniParamsT<T>* param;
 
 
 public:
-	LinearNode() : Node(){
+	LinearNodeT() : Node(){
 		in = NULL;
 
 		param = NULL;
@@ -232,13 +387,17 @@ public:
 	}
 
 
-	inline void setParam(UniParams* paramInit) {
+	inline void setParam(UniParamsT<T>* paramInit) {
 		param = paramInit;
 		if(param->bUseB){
 			std::cout << "Please check bUseB of the param" << std::endl;
 		}
 		inDim = param->W.inDim();
 	}
+
+	inline double flops() const {
+		return 2.0 * inDim * dim;
+	}
 	
 	inline void clearValue(){
 		Node::clearValue();
@@ -248,18 +407,64 @@ public:
 
 public:
 	void forward(Graph *cg, PNode x) {
-		in = x;		
-		val.mat() = param->W.val.mat() * in->val.mat();
-
+		in = x;
+		cg->require(in);
 		in->increase_loc();
+		if (cg->defer(this)) return;
+
+		compute();
 		cg->addNode(this);
 	}
 
+	inline bool overwrites() const {
+		return true;
+	}
+
+	inline void compute() {
+		val.mat() = param->W.val.mat() * in->val.mat();
+	}
+
 	void backward() {
 		param->W.grad.mat() += loss.mat() * in->val.tmat();
 		in->loss.mat() += param->W.val.mat().transpose() * loss.mat();
 	}
 
+public:
+	inline const void* paramKey() const {
+		return param;
+	}
+
+	inline void forward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x(inDim, count), y(dim, count);
+		for (int idx = 0; idx < count; idx++) {
+			x.col(idx) = ((LinearNodeT*)batch[idx])->in->val.mat();
+		}
+
+		y.noalias() = param->W.val.mat() * x;
+
+		for (int idx = 0; idx < count; idx++) {
+			((LinearNodeT*)batch[idx])->val.mat() = y.col(idx);
+		}
+	}
+
+	inline void backward_batch(const vector<PNode>& batch) {
+		int count = batch.size();
+		MatBufferT<T> x(inDim, count), ly(dim, count), lx(inDim, count);
+		for (int idx = 0; idx < count; idx++) {
+			LinearNodeT* ptr = (LinearNodeT*)batch[idx];
+			ly.col(idx) = ptr->loss.mat();
+			x.col(idx) = ptr->in->val.mat();
+		}
+
+		param->W.grad.mat().noalias() += ly * x.transpose();
+
+		lx.noalias() = param->W.val.mat().transpose() * ly;
+		for (int idx = 0; idx < count; idx++) {
+			((LinearNodeT*)batch[idx])->in->loss.mat() += lx.col(idx);
+		}
+	}
+
 
 	inline void unlock(){
 		in->decrease_loc();
@@ -269,4 +474,6 @@ public:
 
 };
 
+typedef LinearNodeT<dtype> LinearNode;
+
 #endif /* UNIOP_H_ */
@@ -18,6 +18,11 @@ public:
 
 	Node bucket;
 
+	vector<PNode> _in_nodes;
+
+	int _capacity;  //nodes with their tensors allocated
+	AlignedMemoryPool* _mem;
+
 public:
 	WindowBuilder(){
 		clear();
@@ -39,6 +44,8 @@ public:
 		_nSize = 0;
 		_inDim = 0;
 		_outDim = 0;
+		_capacity = 0;
+		_mem = NULL;
 	}
 
 
@@ -47,13 +54,22 @@ public:
 		_window = 2 * _context + 1;
 		_inDim = inDim;
 		_outDim = _window * _inDim;
-		int maxsize = _outputs.size();
-		for(int idx = 0; idx < maxsize; idx++){
-			_outputs[idx].init(_outDim, -1, mem); // dropout is not supported here
-		}
+		_capacity = 0;
+		_mem = mem;
 		bucket.init(_inDim, -1, mem);
 		bucket.set_bucket();
 	}
+
+	// the tensors of the nodes are allocated on demand, see reserveNodes
+	inline bool reserve(int size) {
+		return reserveNodes("window", size, _outputs.size(), _capacity, _mem, [&](int idx, AlignedMemoryPool* mem) {
+			_outputs[idx].init(_outDim, -1, mem); // dropout is not supported here
+		});
+	}
+
+	inline size_t bytes() const {
+		return nodeBytes(_outputs) + bucket.bytes();
+	}
 	
 	
 
@@ -65,16 +81,17 @@ public:
 		}
 
 		_nSize = x.size();
+		if (!reserve(_nSize)) return;
 
-		vector<PNode> in_nodes(_window);
+		_in_nodes.resize(_window);
 		for (int idx = 0; idx < _nSize; idx++){
 			int offset = 0;
-			in_nodes[offset++] = x[idx];
+			_in_nodes[offset++] = x[idx];
 			for (int j = 1; j <= _context; j++){
-				in_nodes[offset++] = idx - j >= 0 ? x[idx - j] : &bucket;
-				in_nodes[offset++] = idx + j < _nSize ? x[idx + j] : &bucket;
+				_in_nodes[offset++] = idx - j >= 0 ? x[idx - j] : &bucket;
+				_in_nodes[offset++] = idx + j < _nSize ? x[idx + j] : &bucket;
 			}
-			_outputs[idx].forward(cg, in_nodes);
+			_outputs[idx].forward(cg, _in_nodes);
 		}
 	}
 